@@ -0,0 +1,413 @@
+/*  bench.c
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+/*
+ * Throughput and latency benchmark with YCSB-style workloads. Built
+ * with optimizations by `make bench`, separately from the smoke test.
+ *
+ *   bench/bench [-n keys] [-o ops] [-b b1,b2,...] [-w workload]
+ *               [-d distribution] [-f csv|json] [-s seed]
+ *
+ * For every branching factor, workload and key distribution a tree is
+ * bulk loaded with n keys and then ops operations are timed one by one.
+ * Workloads:
+ *   read   95% lookups, 5% updates
+ *   write  50% lookups, 50% updates
+ *   scan   95% scans of up to 100 keys, 5% insertions
+ *   insert 100% insertions of new keys
+ * Distributions: uniform, zipf (scrambled Zipfian, theta 0.99) and seq
+ * (keys in increasing order). "all" runs every workload or distribution.
+ * Loaded keys are the even numbers below 2n; insertions add odd ones.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bplustree.h"
+
+#define MAX_B (16)
+#define SCAN_MAX (100)
+#define ZIPF_THETA (0.99)
+#define LOAD_FILL (0.8)
+
+enum { W_READ, W_WRITE, W_SCAN, W_INSERT, NWORKLOADS };
+enum { D_UNIFORM, D_ZIPF, D_SEQ, NDISTS };
+
+/* keeps lookups from being optimized away */
+static volatile int sink;
+
+static const char *workload_names[NWORKLOADS] = { "read", "write", "scan", "insert" };
+static const char *dist_names[NDISTS] = { "uniform", "zipf", "seq" };
+
+/* percentage of reads (lookups or scans) in each workload */
+static const int read_pct[NWORKLOADS] = { 95, 50, 95, 0 };
+
+typedef struct gen {
+    int dist;
+    long n;
+    unsigned long long rng;
+    long seq;
+    double zetan;
+    double alpha;
+    double eta;
+}gen_t;
+
+typedef struct result {
+    int b;
+    int workload;
+    int dist;
+    long keys;
+    long ops;
+    double secs;
+    unsigned int p50;
+    unsigned int p99;
+    unsigned int p999;
+}result_t;
+
+/* xorshift64* */
+static inline unsigned long long
+_rand( gen_t *g )
+{
+    g->rng ^= g->rng >> 12;
+    g->rng ^= g->rng << 25;
+    g->rng ^= g->rng >> 27;
+
+    return g->rng * 2685821657736338717ULL;
+}
+
+static inline double
+_rand_unit( gen_t *g )
+{
+    return ( _rand( g ) >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+static long zeta_n;
+static double zeta_cached;
+
+static double
+_zeta( long n, double theta )
+{
+    long i;
+    double sum = 0;
+
+    for( i=1; i<=n; i++ )
+        sum += 1.0 / pow( (double)i, theta );
+
+    return sum;
+}
+
+/*
+ * The Zipfian generator of Gray et al. as used by YCSB. Ranks are
+ * hashed over the key space so that popular keys do not cluster in
+ * the same leaves.
+ */
+static void
+_gen_init( gen_t *g, int dist, long n, unsigned long long seed )
+{
+    double zeta2;
+
+    g->dist = dist;
+    g->n = n;
+    g->rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+    g->seq = 0;
+
+    if( dist == D_ZIPF ){
+        //zeta(n) takes n pow() calls, reuse it across runs
+        if( zeta_n != n ){
+            zeta_cached = _zeta( n, ZIPF_THETA );
+            zeta_n = n;
+        }
+        g->zetan = zeta_cached;
+        zeta2 = _zeta( 2, ZIPF_THETA );
+        g->alpha = 1.0 / ( 1.0 - ZIPF_THETA );
+        g->eta = ( 1 - pow( 2.0 / n, 1 - ZIPF_THETA ) ) / ( 1 - zeta2 / g->zetan );
+    }
+}
+
+/* next key index in [0, n) */
+static inline long
+_gen_next( gen_t *g )
+{
+    double u, uz;
+    long rank;
+
+    switch( g->dist ){
+    case D_SEQ:
+        if( g->seq == g->n )
+            g->seq = 0;
+        return g->seq++;
+    case D_ZIPF:
+        u = _rand_unit( g );
+        uz = u * g->zetan;
+        if( uz < 1.0 )
+            rank = 0;
+        else if( uz < 1.0 + pow( 0.5, ZIPF_THETA ) )
+            rank = 1;
+        else
+            rank = (long)( g->n * pow( g->eta * u - g->eta + 1, g->alpha ) );
+        if( rank >= g->n )
+            rank = g->n - 1;
+        return ( rank * 0x9E3779B97F4A7C15ULL >> 7 ) % g->n;
+    default:
+        return _rand( g ) % g->n;
+    }
+}
+
+static inline unsigned long long
+_now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+_cmp_uint( const void *a, const void *b )
+{
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* stop a scan after the requested number of keys */
+static int
+_scan_cb( int key, int data, void *arg )
+{
+    return --*(int *)arg <= 0;
+}
+
+static bpt_t *
+_load( int b, long n, int *keys )
+{
+    bpt_t *t = bptInit( b );
+
+    if( t && bptBulkLoad( t, keys, keys, n, LOAD_FILL ) ){
+        bptDestroy( t );
+        t = NULL;
+    }
+
+    return t;
+}
+
+static void
+_run( result_t *r, int *keys, unsigned int *lat, unsigned long long seed )
+{
+    long i;
+    int key, left;
+    gen_t g;
+    bpt_t *t;
+    unsigned long long start, t0, t1;
+
+    t = _load( r->b, r->keys, keys );
+    if( !t ){
+        printf("Cannot load %ld keys with b=%d\n", r->keys, r->b);
+        exit( 1 );
+    }
+
+    _gen_init( &g, r->dist, r->keys, seed );
+
+    start = _now_ns();
+    for( i=0; i<r->ops; i++ ){
+        key = 2 * (int)_gen_next( &g );
+
+        t0 = _now_ns();
+        if( (int)( _rand( &g ) % 100 ) < read_pct[r->workload] ){
+            if( r->workload == W_SCAN ){
+                left = 1 + _rand( &g ) % SCAN_MAX;
+                bptScan( t, key, 2 * (int)r->keys, _scan_cb, &left );
+            }
+            else
+                sink = bptGet( t, key );
+        }
+        else if( r->workload == W_SCAN || r->workload == W_INSERT )
+            bptUpsert( t, key + 1, key + 1, NULL );
+        else
+            bptUpsert( t, key, key, NULL );
+        t1 = _now_ns();
+
+        lat[i] = t1 - t0 > 0xffffffffULL ? 0xffffffffU : (unsigned int)( t1 - t0 );
+    }
+    r->secs = ( _now_ns() - start ) / 1e9;
+
+    qsort( lat, r->ops, sizeof(unsigned int), _cmp_uint );
+    r->p50 = lat[r->ops * 50 / 100];
+    r->p99 = lat[r->ops * 99 / 100];
+    r->p999 = lat[r->ops * 999 / 1000];
+
+    bptDestroy( t );
+}
+
+static void
+_print( const result_t *r, int json, int first )
+{
+    const char *fmt = json ?
+        "%s  {\"b\": %d, \"workload\": \"%s\", \"dist\": \"%s\", \"keys\": %ld, \"ops\": %ld, "
+        "\"secs\": %.3f, \"ops_per_sec\": %.0f, \"p50_ns\": %u, \"p99_ns\": %u, \"p999_ns\": %u}" :
+        "%s%d,%s,%s,%ld,%ld,%.3f,%.0f,%u,%u,%u\n";
+
+    printf( fmt, json && !first ? ",\n" : "",
+            r->b, workload_names[r->workload], dist_names[r->dist], r->keys, r->ops,
+            r->secs, r->ops / r->secs, r->p50, r->p99, r->p999 );
+}
+
+static int
+_lookup( const char *name, const char **names, int count )
+{
+    int i;
+
+    if( !strcmp( name, "all" ) )
+        return count;
+
+    for( i=0; i<count; i++ )
+        if( !strcmp( name, names[i] ) )
+            return i;
+
+    return -1;
+}
+
+static void
+_help( void )
+{
+    printf("usage: bench [-n keys] [-o ops] [-b b1,b2,...] [-w read|write|scan|insert|all]\n");
+    printf("             [-d uniform|zipf|seq|all] [-f csv|json] [-s seed]\n");
+}
+
+int
+main( int argc, char *argv[] )
+{
+    int opt, i, w, d, nb = 0, json = 0, first = 1;
+    int bs[MAX_B];
+    int workload = NWORKLOADS, dist = NDISTS;
+    long n = 1000000, ops = 1000000, k;
+    unsigned long long seed = 1;
+    char *tok;
+    int *keys;
+    unsigned int *lat;
+    result_t r;
+
+    while( ( opt = getopt( argc, argv, "n:o:b:w:d:f:s:h" ) ) != -1 ){
+        switch( opt ){
+        case 'n':
+            n = atol( optarg );
+            break;
+        case 'o':
+            ops = atol( optarg );
+            break;
+        case 'b':
+            for( tok = strtok( optarg, "," ); tok && nb < MAX_B; tok = strtok( NULL, "," ) )
+                bs[nb++] = atoi( tok );
+            break;
+        case 'w':
+            workload = _lookup( optarg, workload_names, NWORKLOADS );
+            break;
+        case 'd':
+            dist = _lookup( optarg, dist_names, NDISTS );
+            break;
+        case 'f':
+            json = !strcmp( optarg, "json" );
+            break;
+        case 's':
+            seed = strtoull( optarg, NULL, 10 );
+            break;
+        default:
+            _help();
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+
+    if( nb == 0 )
+        bs[nb++] = 16;
+
+    /* keys are even numbers below 2n, which must fit in an int */
+    if( n < 2 || n > 500000000L || ops < 1 || workload < 0 || dist < 0 ){
+        _help();
+        return -1;
+    }
+    for( i=0; i<nb; i++ ){
+        if( bs[i] < 3 ){
+            printf("Branching factor must be at least 3\n");
+            return -1;
+        }
+    }
+
+    keys = (int *)malloc( n * sizeof(int) );
+    lat = (unsigned int *)malloc( ops * sizeof(unsigned int) );
+    if( !keys || !lat ){
+        printf("Out of memory\n");
+        return -1;
+    }
+    for( k=0; k<n; k++ )
+        keys[k] = 2 * (int)k;
+
+    if( json )
+        printf("[\n");
+    else
+        printf("b,workload,dist,keys,ops,secs,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+
+    for( i=0; i<nb; i++ ){
+        for( w=0; w<NWORKLOADS; w++ ){
+            if( workload != NWORKLOADS && w != workload )
+                continue;
+            for( d=0; d<NDISTS; d++ ){
+                if( dist != NDISTS && d != dist )
+                    continue;
+
+                r.b = bs[i];
+                r.workload = w;
+                r.dist = d;
+                r.keys = n;
+                r.ops = ops;
+                _run( &r, keys, lat, seed );
+                _print( &r, json, first );
+                first = 0;
+                fflush( stdout );
+            }
+        }
+    }
+
+    if( json )
+        printf("\n]\n");
+
+    free( keys );
+    free( lat );
+
+    return 0;
+}
@@ -36,95 +36,338 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
 
 #include "bplustree.h"
+#include "keysearch.h"
 
 static void _descend( bpt_t *tree, node_t *node, int key );
+static int _olc_get( bpt_t *tree, int key );
+static int _olc_put( bpt_t *tree, int key, int data, int mode );
+static void _olc_remove( bpt_t *tree, int key );
+static void _unpack( bpt_t *tree );
+
+/*
+ * How an insertion treats a key already in the tree. PUT_ALWAYS adds
+ * another entry, the others find the existing one first. The values
+ * double as the log record types.
+ */
+enum {
+    PUT_ALWAYS = WAL_PUT,
+    PUT_UPSERT = WAL_UPSERT,
+    PUT_IF_ABSENT = WAL_INSERT_IF_ABSENT,
+    PUT_REPLACE = WAL_REPLACE,
+};
+
+/*
+ * Operation counters for bptStats, compiled in only with BPT_STATS.
+ * Concurrent operations may update them at once.
+ */
+#ifdef BPT_STATS
+#define STAT_ADD(tree, field, v) __atomic_fetch_add( &(tree)->counters.field, (v), __ATOMIC_RELAXED )
+#else
+#define STAT_ADD(tree, field, v) do {} while( 0 )
+#endif
+#define STAT_INC(tree, field) STAT_ADD( tree, field, 1 )
+
+/* picked on the first bptInit from the host's CPU features */
+static key_search_fn key_search = key_binary_search;
+static pthread_once_t key_search_once = PTHREAD_ONCE_INIT;
+
+static void
+_key_search_init( void )
+{
+    key_search = keySearchSelect();
+}
+
+#define NODES_PER_SLAB (64)
+#define UNPACK_FILL (0.7)
+#define CACHE_LINE (64)
+#define LINE_ALIGN(x) ( ((x) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1) )
+
+/*
+ * Every node is a single slab block: the struct is followed by its
+ * key array and then the data or children array. The struct and each
+ * array start on a cache line boundary.
+ */
+static size_t
+_leaf_size( int nKeys )
+{
+    return LINE_ALIGN(sizeof(leaf_t)) + 2 * LINE_ALIGN(nKeys * sizeof(int));
+}
+
+static size_t
+_non_leaf_size( int nKeys )
+{
+    return LINE_ALIGN(sizeof(nonleaf_t)) + LINE_ALIGN(nKeys * sizeof(int))
+        + LINE_ALIGN((nKeys+1) * sizeof(node_t *));
+}
 
+/* b factor of the largest node of the given type fitting in bytes */
 static int
-key_binary_search(int *arr, int len, int key)
+_b_for_size( int type, int bytes )
 {
-    int low = -1;
-    int high = len;
-    int mid;
+    int nKeys = bytes / sizeof(int);
 
-    while (low + 1 < high) {
-        mid = low + (high - low) / 2;
-        if (key > arr[mid]) 
-            low = mid;
-        else
-            high = mid;
+    while( nKeys > 0 && ( type == BPLUS_TREE_LEAF ? _leaf_size(nKeys) : _non_leaf_size(nKeys) ) > bytes )
+        nKeys--;
+
+    return ( nKeys + 1 ) / 2;
+}
+
+static inline int
+_node_b( bpt_t *tree, node_t *node )
+{
+    return node->type == BPLUS_TREE_LEAF ? tree->b_leaf : tree->b_inner;
+}
+
+static inline int
+_node_full( bpt_t *tree, node_t *node )
+{
+    return node->n == 2*_node_b( tree, node )-1;
+}
+
+/* drop the frozen index and the learned model before the tree is modified */
+static inline void
+_thaw( bpt_t *tree )
+{
+    if( tree->frozen ){
+        eytzFree( tree->frozen );
+        tree->frozen = NULL;
+    }
+    if( tree->model ){
+        plmFree( tree->model );
+        tree->model = NULL;
+    }
+}
+
+/*
+ * The leaf a lookup of key goes to when the tree has a static index:
+ * the learned model's leaf if the model confirms it, otherwise the
+ * frozen index's, or the one a descent from the root reaches. NULL
+ * when the tree has neither index.
+ */
+static inline node_t *
+_route( bpt_t *tree, int key )
+{
+    int i;
+    void *leaf;
+    node_t *node;
+
+    if( tree->model ){
+        if( plmFind( tree->model, key, &leaf ) ){
+            STAT_INC( tree, model_hits );
+            return (node_t *)leaf;
+        }
+        STAT_INC( tree, model_misses );
     }
 
-    if (high >= len || arr[high] != key) 
-        return -high - 1;
-    else 
-        return high;
+    if( tree->frozen )
+        return (node_t *)eytzFind( tree->frozen, key );
+
+    if( !tree->model )
+        return NULL;
+
+    node = tree->root;
+    while( node->type == BPLUS_TREE_NON_LEAF ){
+        i = key_search( node->key, node->n, key );
+        if( i < 0 )
+            i = -i - 1;
+        node = ((nonleaf_t *)node)->children[i];
+    }
+
+    return node;
 }
 
+/* index of the first key >= key in node */
 static int
-_nodeInit( node_t *new, bpt_t *tree, int type )
+_first_geq( node_t *node, int key )
 {
-    int nKeys = tree->b_factor*2-1;
+    int i = key_search( node->key, node->n, key );
 
-    new->type = type;
-    new->n = 0;
-    
-    new->key =  (int *) malloc ( sizeof(int)*nKeys );
-    memset( new->key, 0xff, nKeys * sizeof(int) );
+    if( i < 0 )
+        return -i - 1;
+    while( i > 0 && node->key[i-1] == key )
+        i--;
+    return i;
+}
 
-    return 0;    
+/* index of the first key > key in node */
+static int
+_first_gt( node_t *node, int key )
+{
+    int i = _first_geq( node, key );
+
+    while( i < node->n && node->key[i] == key )
+        i++;
+    return i;
+}
+
+/*
+ * Optimistic lock coupling. A node's version word has bit 0 set once
+ * the node is unlinked from the tree and bit 1 set while a writer
+ * holds it; every unlock bumps the counter in the remaining bits.
+ * Readers remember the version, read the node without locking and
+ * validate the version afterwards, restarting from the root if the
+ * node changed underneath them. Writers upgrade the versions they
+ * read to a lock and restart if the upgrade fails. tree->root_version
+ * guards the root pointer the same way.
+ */
+#define OLC_OBSOLETE (1UL)
+#define OLC_LOCKED (2UL)
+
+static inline int
+_olc_read_lock( unsigned long *version, unsigned long *v )
+{
+    *v = __atomic_load_n( version, __ATOMIC_ACQUIRE );
+
+    return !( *v & ( OLC_LOCKED | OLC_OBSOLETE ) );
+}
+
+static inline int
+_olc_validate( unsigned long *version, unsigned long v )
+{
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+
+    return __atomic_load_n( version, __ATOMIC_RELAXED ) == v;
+}
+
+static inline int
+_olc_upgrade( unsigned long *version, unsigned long v )
+{
+    return __atomic_compare_exchange_n( version, &v, v + OLC_LOCKED, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED );
+}
+
+static inline int
+_olc_write_lock( unsigned long *version )
+{
+    unsigned long v;
+
+    return _olc_read_lock( version, &v ) && _olc_upgrade( version, v );
+}
+
+static inline void
+_olc_unlock( unsigned long *version )
+{
+    __atomic_fetch_add( version, OLC_LOCKED, __ATOMIC_RELEASE );
+}
+
+static inline void
+_olc_unlock_obsolete( unsigned long *version )
+{
+    __atomic_fetch_add( version, OLC_LOCKED + OLC_OBSOLETE, __ATOMIC_RELEASE );
+}
+
+static void *
+_node_alloc( bpt_t *tree, slab_t *pool )
+{
+    void *node;
+
+    if( !tree->concurrent )
+        return slabAlloc( pool );
+
+    pthread_mutex_lock( &tree->pool_lock );
+    node = slabAlloc( pool );
+    pthread_mutex_unlock( &tree->pool_lock );
+
+    return node;
 }
 
+/* epoch reclaim callback: the node is no longer reachable by anyone */
 static void
-_nodeDestroy( node_t *node )
+_node_reclaim( void *ctx, void *node, void *pool )
 {
-    free( node->key );
+    bpt_t *tree = (bpt_t *)ctx;
 
-    return;
+    pthread_mutex_lock( &tree->pool_lock );
+    slabFree( (slab_t *)pool, node );
+    pthread_mutex_unlock( &tree->pool_lock );
+}
+
+/*
+ * In concurrent mode the node is write locked by the caller and may
+ * still be read by optimistic readers, so it is marked obsolete and
+ * handed back to the pool only once every thread that could have
+ * reached it has left its operation.
+ */
+static void
+_node_free( bpt_t *tree, slab_t *pool, node_t *node )
+{
+    if( tree->concurrent ){
+        _olc_unlock_obsolete( &node->version );
+        epochRetire( &tree->epoch, node, pool );
+    }
+    else{
+        if( node == (node_t *)tree->last )
+            tree->last = NULL;
+        slabFree( pool, node );
+    }
+}
+
+static int
+_nodeInit( node_t *new, int *key, int nKeys, int type )
+{
+    new->type = type;
+    new->n = 0;
+    new->version = 0;
+    
+    new->key = key;
+    memset( new->key, 0xff, nKeys * sizeof(int) );
+
+    return 0;    
 }
 
+/* lay out a non-leaf in a block from a non-leaf pool */
 static struct non_leaf *
-non_leaf_new( bpt_t *tree )
+_non_leaf_init( bpt_t *tree, void *block )
 {
-    int nKeys = tree->b_factor*2-1;
+    int nKeys = tree->b_inner*2-1;
     int nChildren = nKeys+1;
+    char *keys;
 
-    nonleaf_t *new = (nonleaf_t *)malloc(sizeof(nonleaf_t));
+    nonleaf_t *new = (nonleaf_t *)block;
 
     assert(new);
 
-    _nodeInit( &new->node, tree, BPLUS_TREE_NON_LEAF );
+    keys = (char *)new + LINE_ALIGN(sizeof(nonleaf_t));
+    _nodeInit( &new->node, (int *)keys, nKeys, BPLUS_TREE_NON_LEAF );
 
-    new->children = (node_t **)malloc(nChildren * sizeof(node_t *)); 
+    new->children = (node_t **)(keys + LINE_ALIGN(nKeys * sizeof(int))); 
     memset(new->children, 0, nChildren * sizeof(node_t *));
 
     return new;
 }
 
+static struct non_leaf *
+non_leaf_new( bpt_t *tree )
+{
+    return _non_leaf_init( tree, _node_alloc( tree, &tree->non_leaf_pool ) );
+}
+
 static void 
-non_leaf_destroy( nonleaf_t **nonleaf )
+non_leaf_destroy( bpt_t *tree, nonleaf_t **nonleaf )
 {
-    free( (*nonleaf)->children );
-    _nodeDestroy( &(*nonleaf)->node );
-    free( *nonleaf );
+    _node_free( tree, &tree->non_leaf_pool, &(*nonleaf)->node );
     *nonleaf = NULL;
 
     return;
 }
 
+/* lay out a leaf in a block from a leaf pool */
 static leaf_t *
-leaf_new( bpt_t *tree )
+_leaf_init( bpt_t *tree, void *block )
 {
-    int nKeys = tree->b_factor*2-1;
+    int nKeys = tree->b_leaf*2-1;
+    char *keys;
 
-    leaf_t *new = (leaf_t*)malloc(sizeof(leaf_t));
+    leaf_t *new = (leaf_t*)block;
     assert(new);
 
-    _nodeInit( &new->node, tree, BPLUS_TREE_LEAF );
+    keys = (char *)new + LINE_ALIGN(sizeof(leaf_t));
+    _nodeInit( &new->node, (int *)keys, nKeys, BPLUS_TREE_LEAF );
 
-    new->data = (int *) malloc ( sizeof(int)*nKeys );
-    assert( new->data );
+    new->data = (int *)(keys + LINE_ALIGN(nKeys * sizeof(int)));
     memset( new->data, 0xff, nKeys * sizeof(int) );
 
     new->next = NULL;
@@ -133,19 +376,23 @@ leaf_new( bpt_t *tree )
     return new;
 }
 
+static leaf_t *
+leaf_new( bpt_t *tree )
+{
+    return _leaf_init( tree, _node_alloc( tree, &tree->leaf_pool ) );
+}
+
 static void
-leaf_destroy( leaf_t **leaf )
+leaf_destroy( bpt_t *tree, leaf_t **leaf )
 {
-    free( (*leaf)->data );
-    _nodeDestroy( &(*leaf)->node );
-    free( *leaf );
+    _node_free( tree, &tree->leaf_pool, &(*leaf)->node );
     *leaf = NULL;
 
     return;
 }
 
 static int
-_node_search( node_t *node, int key ){
+_node_search( bpt_t *tree, node_t *node, int key ){
     
     int i;
 
@@ -153,9 +400,11 @@ _node_search( node_t *node, int key ){
     leaf_t *ln;
     node_t *child;
 
+    STAT_INC( tree, get_visits );
+
     if( node->type == BPLUS_TREE_LEAF ){
         ln = (leaf_t *)node;
-        i = key_binary_search(ln->node.key, ln->node.n, key );
+        i = key_search(ln->node.key, ln->node.n, key );
         if (i >= 0)
             return ln->data[i];
         else 
@@ -165,7 +414,7 @@ _node_search( node_t *node, int key ){
     assert( node->type == BPLUS_TREE_NON_LEAF );
     
     nln = (nonleaf_t *)node;
-    i = key_binary_search(nln->node.key, nln->node.n, key );
+    i = key_search(nln->node.key, nln->node.n, key );
 
     if(i >= 0)
         child = nln->children[i];
@@ -174,18 +423,26 @@ _node_search( node_t *node, int key ){
         child = nln->children[i];
     }
 
-    return _node_search( child, key );
+    return _node_search( tree, child, key );
 }
 
 void
 bptDump(bpt_t *tree)
 {
-    int i;
+    int i, key, data;
     node_t *node;
     leaf_t *leaf;
+    bpt_cursor_t cur;
 
     printf("*******Tree dump*******\n");
 
+    if( tree->snap ){
+        bptCursorSeek( tree, &cur, INT_MIN, INT_MAX );
+        while( bptCursorNext( &cur, &key, &data, 1 ) )
+            printf("Key=%d, data=%d\n", key, data );
+        return;
+    }
+
     if( !tree->root ){
         printf("Empty tree\n");
         return;
@@ -213,24 +470,371 @@ bptDump(bpt_t *tree)
     return;
 }
 
+static void
+_stats_walk( bpt_t *tree, node_t *node, int level, bpt_stats_t *st )
+{
+    int i;
+    double fill;
+
+    st->nodes[level]++;
+    if( level >= st->height )
+        st->height = level+1;
+
+    if( node->type == BPLUS_TREE_LEAF ){
+        fill = (double)node->n / ( 2*tree->b_leaf-1 );
+        st->keys += node->n;
+        st->leaf_fill += fill;
+        if( fill < st->min_leaf_fill )
+            st->min_leaf_fill = fill;
+        return;
+    }
+
+    for( i=0; i<=node->n; i++ )
+        _stats_walk( tree, ((nonleaf_t *)node)->children[i], level+1, st );
+}
+
+static void
+_stats_snap_walk( bpt_t *tree, const snap_node_t *node, int level, bpt_stats_t *st )
+{
+    int i;
+    double fill;
+
+    st->nodes[level]++;
+    if( level >= st->height )
+        st->height = level+1;
+
+    if( node->type == BPLUS_TREE_LEAF ){
+        fill = (double)node->n / ( 2*tree->b_leaf-1 );
+        st->keys += node->n;
+        st->leaf_fill += fill;
+        if( fill < st->min_leaf_fill )
+            st->min_leaf_fill = fill;
+        return;
+    }
+
+    for( i=0; i<=node->n; i++ )
+        _stats_snap_walk( tree, (const snap_node_t *)( tree->snap->base + ((long long *)snapValues( node ))[i] ),
+                          level+1, st );
+}
+
+/*
+ * Fill st with the tree's current shape and memory use, walking every
+ * node, and with the operation counters accumulated so far. Writers
+ * must be excluded meanwhile, as for scans. Packed leaves and those of
+ * a packed snapshot can hold more than a plain leaf, so their fill may
+ * exceed 1.
+ */
+void
+bptStats( bpt_t *tree, bpt_stats_t *st )
+{
+    int l;
+
+    memcpy( st, &tree->counters, sizeof(*st) );
+
+    st->height = 0;
+    for( l=0; l<MAX_LEVEL; l++ )
+        st->nodes[l] = 0;
+    st->keys = 0;
+    st->leaf_fill = 0;
+    st->min_leaf_fill = 0;
+    st->bytes = sizeof(bpt_t) + slabBytes( &tree->leaf_pool ) + slabBytes( &tree->non_leaf_pool );
+    st->model_segments = 0;
+    st->model_max_err = 0;
+    st->model_avg_err = 0;
+
+    if( tree->model ){
+        st->model_segments = tree->model->nsegs;
+        st->model_max_err = tree->model->max_err;
+        st->model_avg_err = tree->model->avg_err;
+    }
+
+    if( tree->snap ){
+        long long root = ((const snap_header_t *)tree->snap->base)->root;
+
+        st->bytes += tree->snap->size;
+        if( !root )
+            return;
+        st->min_leaf_fill = INT_MAX;
+        _stats_snap_walk( tree, (const snap_node_t *)( tree->snap->base + root ), 0, st );
+        st->leaf_fill /= st->nodes[st->height-1];
+        return;
+    }
+
+    if( !tree->root )
+        return;
+
+    st->min_leaf_fill = 1.0;
+    _stats_walk( tree, tree->root, 0, st );
+    st->leaf_fill /= st->nodes[st->height-1];
+}
+
+/*
+ * Descend once to the leaf that may hold the smallest key >= key.
+ * *pos is set to that key's slot, which can be n when the key
+ * lives in the next leaf.
+ */
+static leaf_t *
+_leaf_seek( bpt_t *tree, int key, int *pos )
+{
+    int i;
+    node_t *node = tree->root;
+
+    if( !node )
+        return NULL;
+
+    if( tree->frozen || tree->model )
+        node = _route( tree, key );
+
+    while( node->type == BPLUS_TREE_NON_LEAF ){
+        i = key_search( node->key, node->n, key );
+        if( i < 0 )
+            i = -i - 1;
+        node = ((nonleaf_t *)node)->children[i];
+    }
+
+    i = key_search( node->key, node->n, key );
+    if( i < 0 )
+        i = -i - 1;
+
+    *pos = i;
+
+    return (leaf_t *)node;
+}
+
+void
+bptCursorSeek( bpt_t *tree, bpt_cursor_t *cur, int lo, int hi )
+{
+    cur->leaf = NULL;
+    cur->sleaf = NULL;
+
+    if( tree->snap )
+        cur->sleaf = snapSeek( tree->snap, lo, &cur->pos );
+    else
+        cur->leaf = _leaf_seek( tree, lo, &cur->pos );
+    cur->hi = hi;
+}
+
+static int
+_snap_cursor_next( bpt_cursor_t *cur, int *keys, int *data, int max )
+{
+    int cnt = 0;
+    const snap_node_t *leaf = cur->sleaf;
+
+    while( leaf && cnt<max ){
+        if( cur->pos >= leaf->n ){
+            leaf = snapNext( leaf );
+            cur->pos = 0;
+            continue;
+        }
+
+        if( snapKey( leaf, cur->pos ) > cur->hi ){
+            leaf = NULL;
+            break;
+        }
+
+        keys[cnt] = snapKey( leaf, cur->pos );
+        data[cnt] = snapData( leaf, cur->pos );
+        cnt++;
+        cur->pos++;
+    }
+
+    cur->sleaf = leaf;
+
+    return cnt;
+}
+
+/*
+ * Copy up to max pairs with key <= cur->hi into keys/data,
+ * following the leaf chain. Returns the number of pairs copied,
+ * 0 once the range is exhausted.
+ */
+int
+bptCursorNext( bpt_cursor_t *cur, int *keys, int *data, int max )
+{
+    int cnt = 0;
+    leaf_t *leaf = cur->leaf;
+
+    if( cur->sleaf )
+        return _snap_cursor_next( cur, keys, data, max );
+
+    while( leaf && cnt<max ){
+        if( cur->pos >= leaf->node.n ){
+            leaf = leaf->next;
+            cur->pos = 0;
+            continue;
+        }
+
+        if( leaf->node.key[cur->pos] > cur->hi ){
+            leaf = NULL;
+            break;
+        }
+
+        keys[cnt] = leaf->node.key[cur->pos];
+        data[cnt] = leaf->data[cur->pos];
+        cnt++;
+        cur->pos++;
+    }
+
+    cur->leaf = leaf;
+
+    return cnt;
+}
+
+/*
+ * Call cb on every pair with lo <= key <= hi in key order.
+ * Returns the number of pairs visited.
+ */
+int
+bptScan( bpt_t *tree, int lo, int hi, bpt_scan_cb cb, void *arg )
+{
+    int i, cnt = 0;
+    leaf_t *leaf;
+    const snap_node_t *sleaf;
+
+    if( tree->snap ){
+        for( sleaf = snapSeek( tree->snap, lo, &i ); sleaf; sleaf = snapNext( sleaf ), i = 0 )
+            for( ; i<sleaf->n; i++ ){
+                if( snapKey( sleaf, i ) > hi )
+                    return cnt;
+                cnt++;
+                if( cb( snapKey( sleaf, i ), snapData( sleaf, i ), arg ) )
+                    return cnt;
+            }
+        return cnt;
+    }
+
+    leaf = _leaf_seek( tree, lo, &i );
+
+    while( leaf ){
+        for( ; i<leaf->node.n; i++ ){
+            if( leaf->node.key[i] > hi )
+                return cnt;
+            cnt++;
+            if( cb( leaf->node.key[i], leaf->data[i], arg ) )
+                return cnt;
+        }
+        leaf = leaf->next;
+        i = 0;
+    }
+
+    return cnt;
+}
+
 int
 bptGet( bpt_t *tree, int key )
 {
+    int data;
+
+    if( tree->snap )
+        return snapGet( tree->snap, key );
+
+    STAT_INC( tree, gets );
+
+    if( tree->concurrent ){
+        epochEnter( &tree->epoch );
+        data = _olc_get( tree, key );
+        epochExit( &tree->epoch );
+        return data;
+    }
+
     if( !tree->root )
         return 0;
 
-    return _node_search( tree->root, key );
+    if( tree->frozen || tree->model )
+        return _node_search( tree, _route( tree, key ), key );
+
+    return _node_search( tree, tree->root, key );
+}
+
+#define BATCH_GROUP (16)
+#define PREFETCH_LINES (4)
+
+/* pull the header and the first lines of the key array into cache */
+static inline void
+_node_prefetch( node_t *node )
+{
+    int l;
+
+    for( l=0; l<PREFETCH_LINES; l++ )
+        __builtin_prefetch( (char *)node + l*CACHE_LINE );
+}
+
+/*
+ * Look up n keys, writing each result to out as bptGet would. Lookups
+ * advance in groups of BATCH_GROUP one level at a time: every child is
+ * prefetched as soon as it is known, and its miss overlaps with the
+ * searches of the other nodes in the group. A frozen or learned tree
+ * finds all the group's leaves through its index first.
+ */
+void
+bptGetBatch( bpt_t *tree, int *keys, int *out, int n )
+{
+    int base, j, m, i;
+    node_t *cur[BATCH_GROUP];
+    leaf_t *ln;
+
+    if( tree->snap ){
+        for( j=0; j<n; j++ )
+            out[j] = snapGet( tree->snap, keys[j] );
+        return;
+    }
+
+    if( !tree->root ){
+        for( j=0; j<n; j++ )
+            out[j] = 0;
+        return;
+    }
+
+    STAT_ADD( tree, gets, n );
+
+    for( base=0; base<n; base+=BATCH_GROUP ){
+        m = n-base < BATCH_GROUP ? n-base : BATCH_GROUP;
+
+        for( j=0; j<m; j++ ){
+            if( tree->frozen || tree->model ){
+                cur[j] = _route( tree, keys[base+j] );
+                _node_prefetch( cur[j] );
+            }
+            else
+                cur[j] = tree->root;
+        }
+
+        //all leaves are on the same level
+        while( cur[0]->type == BPLUS_TREE_NON_LEAF ){
+            STAT_ADD( tree, get_visits, m );
+            for( j=0; j<m; j++ ){
+                i = key_search( cur[j]->key, cur[j]->n, keys[base+j] );
+                if( i < 0 )
+                    i = -i - 1;
+                cur[j] = ((nonleaf_t *)cur[j])->children[i];
+                _node_prefetch( cur[j] );
+            }
+        }
+
+        STAT_ADD( tree, get_visits, m );
+        for( j=0; j<m; j++ ){
+            ln = (leaf_t *)cur[j];
+            i = key_search( ln->node.key, ln->node.n, keys[base+j] );
+            out[base+j] = i >= 0 ? ln->data[i] : DATA_NOT_EXIST;
+        }
+    }
 }
 
+/*
+ * Split the full child i of node, which keeps its first keep keys. A
+ * leaf's last kept key is copied up as the separator; a non-leaf's key
+ * after the kept ones moves up.
+ */
 static void
-_split_child( bpt_t *tree, node_t *node, int i )
+_split_child_at( bpt_t *tree, node_t *node, int i, int keep )
 {
-    int j;
-    int t = tree->b_factor;
+    int j, sep;
     node_t *y, *z;
     nonleaf_t *nln = (nonleaf_t *)node;
-    nonleaf_t *y_nln, *z_nln;
-    leaf_t *y_ln, *z_ln;
+    nonleaf_t *y_nln = NULL, *z_nln = NULL;
+    leaf_t *y_ln = NULL, *z_ln = NULL;
+
+    STAT_INC( tree, splits );
 
     y = nln->children[i];
     
@@ -245,29 +849,31 @@ _split_child( bpt_t *tree, node_t *node, int i )
         z = &z_nln->node;
     }
 
-    z->n = t-1;
+    //a leaf copies its last kept key up, a non-leaf moves the next one
+    sep = y->type == BPLUS_TREE_LEAF ? keep-1 : keep;
+    z->n = y->n - sep - 1;
 
-    //move the largest t-1 keys and tchildren of y into z
+    //move the keys and children of y after the separator into z
     for( j=0; j<z->n; j++ )
-        z->key[j] = y->key[t+j];
+        z->key[j] = y->key[sep+1+j];
     
 
     if( y->type != BPLUS_TREE_LEAF ){
         for( j=0; j<=z->n; j++ )
-            z_nln->children[j] = y_nln->children[t+j];
+            z_nln->children[j] = y_nln->children[sep+1+j];
     }
     else{
         for( j=0; j<z->n; j++ )
-            z_ln->data[j] = y_ln->data[t+j];
+            z_ln->data[j] = y_ln->data[sep+1+j];
     }
 
     if( y->type == BPLUS_TREE_LEAF ){
-        y->n = t;
         z_ln->next = y_ln->next;
         y_ln->next = z_ln;    
+        if( y_ln == tree->last )
+            tree->last = z_ln;
     }
-    else
-        y->n = t-1;
+    y->n = keep;
 
     //shift child pointers in node dest the right dest create a room for z
     
@@ -279,7 +885,7 @@ _split_child( bpt_t *tree, node_t *node, int i )
     for( j=node->n; j>i; j-- )
         node->key[j] = node->key[j-1];
 
-    node->key[i] = y->key[t-1];
+    node->key[i] = y->key[sep];
     node->n++;
 
     //NODE_WRITE(y);
@@ -288,23 +894,106 @@ _split_child( bpt_t *tree, node_t *node, int i )
 
 }
 
+/* split the full child i of node in half */
 static void
-_insert_nonfull( bpt_t *tree, node_t *node, int key, int data )
+_split_child( bpt_t *tree, node_t *node, int i )
 {
-    int i = node->n;
-    nonleaf_t *nln;
-    leaf_t *ln;
-    
-    if( node->type == BPLUS_TREE_LEAF ){
-        ln = (leaf_t *)node;
-        while( i>=1 && key<node->key[i-1] ){
-            node->key[i] = node->key[i-1];
-            ln->data[i] = ln->data[i-1];
-            i--;    
-        }
+    node_t *y = ((nonleaf_t *)node)->children[i];
+    int t = _node_b( tree, y );
 
-        node->key[i] = key;
-        ln->data[i] = data;
+    _split_child_at( tree, node, i, y->type == BPLUS_TREE_LEAF ? t : t-1 );
+}
+
+/*
+ * How many keys a full node on the right spine keeps when it is split
+ * for an append: a leaf keeps all of them, a non-leaf hands about a
+ * tenth to its new sibling.
+ */
+static int
+_spine_keep( node_t *node )
+{
+    int r = node->n / 10;
+
+    if( node->type == BPLUS_TREE_LEAF )
+        return node->n;
+
+    return node->n - 1 - ( r > 0 ? r : 1 );
+}
+
+/*
+ * Append mode: a key above every key in the tree goes straight into the
+ * cached rightmost leaf. Only when that leaf is full is the right spine
+ * walked from the root, splitting its full nodes unevenly so that keys
+ * arriving in order leave full nodes behind them. Returns 0, having
+ * changed nothing, if key is not above every key in the tree.
+ */
+static int
+_put_append( bpt_t *tree, int key, int data )
+{
+    node_t *node, *child;
+    nonleaf_t *s;
+    leaf_t *last = tree->last;
+
+    if( !tree->root )
+        return 0;
+
+    if( !last ){
+        node = tree->root;
+        while( node->type == BPLUS_TREE_NON_LEAF )
+            node = ((nonleaf_t *)node)->children[node->n];
+        last = tree->last = (leaf_t *)node;
+    }
+
+    if( key <= last->node.key[last->node.n-1] )
+        return 0;
+
+    if( _node_full( tree, &last->node ) ){
+        node = tree->root;
+        if( _node_full( tree, node ) ){
+            s = non_leaf_new( tree );
+            s->children[0] = node;
+            tree->root = &s->node;
+            _split_child_at( tree, &s->node, 0, _spine_keep( node ) );
+            node = tree->root;
+        }
+
+        while( node->type == BPLUS_TREE_NON_LEAF ){
+            STAT_INC( tree, put_visits );
+            child = ((nonleaf_t *)node)->children[node->n];
+            if( _node_full( tree, child ) )
+                _split_child_at( tree, node, node->n, _spine_keep( child ) );
+            node = ((nonleaf_t *)node)->children[node->n];
+        }
+        last = tree->last = (leaf_t *)node;
+    }
+
+    STAT_INC( tree, put_visits );
+    last->node.key[last->node.n] = key;
+    last->data[last->node.n] = data;
+    last->node.n++;
+
+    return 1;
+}
+
+static void
+_insert_nonfull( bpt_t *tree, node_t *node, int key, int data )
+{
+    int i = node->n;
+    nonleaf_t *nln;
+    leaf_t *ln;
+
+    STAT_INC( tree, put_visits );
+    
+    if( node->type == BPLUS_TREE_LEAF ){
+        ln = (leaf_t *)node;
+        while( i>=1 && key<node->key[i-1] ){
+            node->key[i] = node->key[i-1];
+            ln->data[i] = ln->data[i-1];
+            i--;    
+        }
+
+        node->key[i] = key;
+        ln->data[i] = data;
 
         node->n ++;
         //NODE_WRITE(node);
@@ -312,7 +1001,7 @@ _insert_nonfull( bpt_t *tree, node_t *node, int key, int data )
     else{
         assert( node->type == BPLUS_TREE_NON_LEAF );
 
-        while( i>=1 && key<node->key[i-1] )
+        while( i>=1 && key<=node->key[i-1] )
             i--;
 
         i++;
@@ -320,7 +1009,7 @@ _insert_nonfull( bpt_t *tree, node_t *node, int key, int data )
         
         nln = (nonleaf_t *)node;
 
-        if( nln->children[i-1]->n == tree->b_factor*2-1 ){
+        if( _node_full( tree, nln->children[i-1] ) ){
             _split_child( tree, node, i-1 );
             if( key>node->key[i-1] )
                 i=i+1;
@@ -331,12 +1020,25 @@ _insert_nonfull( bpt_t *tree, node_t *node, int key, int data )
 }
 
 
-void
-bptPut( bpt_t *tree, int key, int data)
+static void
+_put( bpt_t *tree, int key, int data )
 {
     node_t *node;
     nonleaf_t *s;
 
+    STAT_INC( tree, puts );
+    _thaw( tree );
+
+    if( tree->concurrent ){
+        epochEnter( &tree->epoch );
+        _olc_put( tree, key, data, PUT_ALWAYS );
+        epochExit( &tree->epoch );
+        return;
+    }
+
+    if( tree->append && _put_append( tree, key, data ) )
+        return;
+
     if (tree->root == NULL) { //empty tree
         leaf_t *leaf = leaf_new(tree);
         tree->root = &leaf->node;
@@ -344,7 +1046,7 @@ bptPut( bpt_t *tree, int key, int data)
 
     node = tree->root;
 
-    if( node->n == tree->b_factor*2-1 ){
+    if( _node_full( tree, node ) ){
         s = non_leaf_new(tree);
         tree->root = &s->node;
         s->children[0] = node;
@@ -357,354 +1059,2531 @@ bptPut( bpt_t *tree, int key, int data)
     return;
 }
 
-static void 
-_node_key_shift_left( node_t *node, int index, int ptr_shift) 
+/*
+ * Checkpoint unless the log is below min_bytes by the time writers are
+ * stopped, as when another thread checkpointed first.
+ */
+static int
+_checkpoint( bpt_t *tree, long long min_bytes )
 {
-    int idx;
-    nonleaf_t *nln;
-    leaf_t *ln;
-    
-    if( node->type == BPLUS_TREE_LEAF ){
-        ln = (leaf_t *)node;
-        for( idx=index; idx<node->n-1; idx++ ){
-            node->key[idx] = node->key[idx+1];
-            ln->data[idx] = ln->data[idx+1];
-        }
+    unsigned long long lsn;
+    int due, ret = 0;
 
-    }
-    else{ 
+    lsn = walCheckpointBegin( tree->wal );
+    due = tree->wal->size >= min_bytes;
+    if( due )
+        ret = walCheckpointWrite( tree->ckpt_path, lsn, tree );
+    walCheckpointEnd( tree->wal, due && ret == 0 );
 
-        nln = (nonleaf_t *)node;
+    return ret;
+}
 
-        for( idx=index; idx<node->n-1; idx++ ){
-            node->key[idx] = node->key[idx+1];
-            if( ptr_shift )
-                nln->children[idx]=nln->children[idx+1];
-        }
+/*
+ * Wait for record lsn to be durable, then checkpoint if the log has
+ * outgrown the tree's limit. Returns -1 if the record could not be
+ * made durable.
+ */
+static int
+_wal_commit( bpt_t *tree, unsigned long long lsn )
+{
+    int r = walCommit( tree->wal, lsn );
 
-        if( ptr_shift )
-            nln->children[node->n-1]=nln->children[node->n];
-    }
+    if( tree->ckpt_bytes > 0 &&
+        __atomic_load_n( &tree->wal->size, __ATOMIC_RELAXED ) >= tree->ckpt_bytes )
+        _checkpoint( tree, tree->ckpt_bytes );
 
-    node->n--;
+    return r;
 }
 
-static void 
-_node_key_shift_right( node_t *node, int index, int ptr_shift )
+/*
+ * With a log attached the insertion is logged first and the call
+ * returns once its record is durable. Returns 0, or -1 if the tree is
+ * a snapshot or the log failed; the insertion is then applied in
+ * memory but not durable.
+ */
+int
+bptPut( bpt_t *tree, int key, int data)
 {
+    unsigned long long lsn;
 
-    int idx;
-    nonleaf_t *nln;
-    leaf_t *ln;
-    
-    assert( index<=node->n );
-    
-    if( node->type == BPLUS_TREE_LEAF ){
-        ln = (leaf_t *)node;
-        for( idx=node->n; idx>index; idx-- ){
-            node->key[idx] = node->key[idx-1];
-            ln->data[idx] = ln->data[idx-1];
-        }
+    _unpack( tree );
+    if( tree->snap ){
+        printf("Snapshot is read-only! No insertion\n");
+        return -1;
     }
-    else{
-        nln = (nonleaf_t *)node;
 
-        for( idx=node->n; idx>index; idx-- ){
-            node->key[idx] = node->key[idx-1];
-            if( ptr_shift )
-                nln->children[idx+1]=nln->children[idx]; 
-        } 
- 
-        if( ptr_shift )
-            nln->children[idx+1]=nln->children[idx]; 
+    if( tree->wal ){
+        lsn = walAppend( tree->wal, WAL_PUT, key, data );
+        _put( tree, key, data );
+        return _wal_commit( tree, lsn );
     }
-    
-    node->key[index] = INVALID_KEY;
-    
-    node->n++;
+
+    _put( tree, key, data );
+    return 0;
 }
 
-static void 
-_move_key( int key, node_t *src, node_t *dest, int src_ptr_shift, int dest_ptr_shift )
+/*
+ * Sort n pairs by key into sk/sd with an LSD radix sort, one byte per
+ * pass. Each pass is stable, so equal keys keep their batch order, and
+ * a pass is skipped when all keys share that byte, as the high bytes
+ * of a clustered batch do.
+ */
+static void
+_batch_sort( const int *keys, const int *data, int *sk, int *sd, int n )
 {
-    int src_pos = 0;
-    int dest_pos = 0;
+    int i, pass;
+    int cnt[256];
+    unsigned int u, b;
+    int *tk, *td, *fk, *fd, *xk, *xd;
+
+    tk = (int *)malloc( n * sizeof(int) );
+    td = (int *)malloc( n * sizeof(int) );
+    assert( tk && td );
+
+    memcpy( sk, keys, n * sizeof(int) );
+    memcpy( sd, data, n * sizeof(int) );
+    fk = sk; fd = sd;
+    xk = tk; xd = td;
+
+    for( pass=0; pass<4; pass++ ){
+        memset( cnt, 0, sizeof(cnt) );
+        for( i=0; i<n; i++ ){
+            //flip the sign bit so that negative keys sort first
+            u = (unsigned int)fk[i] ^ 0x80000000u;
+            cnt[ (u >> (pass*8)) & 0xff ]++;
+        }
 
-    while( src_pos<src->n && key>src->key[src_pos] )
-        src_pos++;
-    
-    while( dest_pos<dest->n && key>dest->key[dest_pos] )
-        dest_pos++;
-    
-    _node_key_shift_right( dest, dest_pos, dest_ptr_shift );
-    
-    dest->key[ dest_pos ] = src->key[src_pos]; 
+        b = ( ((unsigned int)fk[0] ^ 0x80000000u) >> (pass*8) ) & 0xff;
+        if( cnt[b] == n )
+            continue;
+
+        for( i=1; i<256; i++ )
+            cnt[i] += cnt[i-1];
+        for( i=n-1; i>=0; i-- ){
+            u = (unsigned int)fk[i] ^ 0x80000000u;
+            b = --cnt[ (u >> (pass*8)) & 0xff ];
+            xk[b] = fk[i];
+            xd[b] = fd[i];
+        }
 
-    if( dest->type == BPLUS_TREE_LEAF )
-        ((leaf_t *)dest)->data[ dest_pos ] = ((leaf_t *)src)->data[src_pos]; 
-    
-    _node_key_shift_left( src, src_pos, src_ptr_shift );
-    
-    //DISK_WRITE(src);
-    //DISK_WRITE(dest);
+        tk = fk; fk = xk; xk = tk;
+        td = fd; fd = xd; xd = td;
+    }
+
+    if( fk != sk ){
+        memcpy( sk, fk, n * sizeof(int) );
+        memcpy( sd, fd, n * sizeof(int) );
+    }
+
+    free( fk != sk ? fk : xk );
+    free( fd != sd ? fd : xd );
 }
 
-static void 
-_merge_node( node_t *left, node_t *right )
+/*
+ * Merge m sorted pairs into a leaf that has room for them, in one pass
+ * from the right. Equal keys go after those already there, as with
+ * _insert_nonfull.
+ */
+static void
+_leaf_merge( node_t *node, const int *keys, const int *data, int m )
 {
-    int k;
-    nonleaf_t *l_nln, *r_nln;
-    leaf_t *l_ln, *r_ln;
-    
-    assert( left->type == right->type );
-
-    if( left->type == BPLUS_TREE_LEAF ){
-        l_ln = (leaf_t *) left;
-        r_ln = (leaf_t *) right;
-    }
-    else{
-        l_nln = (nonleaf_t *) left;
-        r_nln = (nonleaf_t *) right;
-    }
+    int i = node->n-1, j = m-1, w = node->n+m-1;
+    leaf_t *ln = (leaf_t *)node;
 
-    if( left->type == BPLUS_TREE_LEAF ){
-        for( k=0; k<right->n; k++ ){
-            left->key[left->n+k] = right->key[k];
-            l_ln->data[left->n+k] = r_ln->data[k];
+    while( j >= 0 ){
+        if( i >= 0 && node->key[i] > keys[j] ){
+            node->key[w] = node->key[i];
+            ln->data[w] = ln->data[i];
+            i--;
         }
-    }
-    else{ 
-        for( k=0; k<right->n; k++ ){
-            left->key[left->n+k] = right->key[k];
-            l_nln->children[left->n+k] = r_nln->children[k];
+        else{
+            node->key[w] = keys[j];
+            ln->data[w] = data[j];
+            j--;
         }
-    
-        l_nln->children[left->n+right->n] = r_nln->children[right->n];
+        w--;
     }
-    
-    left->n += right->n;
 
-    if( left->type == BPLUS_TREE_LEAF )
-        l_ln->next = r_ln->next;
-    
-    if( right->type==BPLUS_TREE_NON_LEAF )
-        non_leaf_destroy(&r_nln);
-    else
-        leaf_destroy(&r_ln);
-    
-    //DISK_WRITE(left);
-    //DISK_WRITE(right);
+    node->n += m;
 }
 
+/*
+ * Insert n pairs sorted by key. The path of the last descent is kept
+ * with the upper bound of each node's key range, and the next descent
+ * starts from the deepest node on it that covers the next key and is
+ * not full, splitting full children on the way down as _insert_nonfull
+ * does. Each leaf reached takes all the following keys in its range
+ * that fit, in one merge.
+ */
 static void
-_remove_from_leaf( node_t *node, int idx )
+_put_sorted( bpt_t *tree, const int *keys, const int *data, int n )
 {
-    int i = idx;
-    leaf_t *ln = (leaf_t *)node;
-    
-    assert( node->type == BPLUS_TREE_LEAF);
-    assert( idx<node->n );
-    
-    while( i<node->n-1 ){
-        node->key[i] = node->key[i+1];
-        ln->data[i] = ln->data[i+1];
-        i++;
+    int h = 0, l, i, m, room, pos = 0;
+    long long ub[MAX_LEVEL];
+    node_t *path[MAX_LEVEL];
+    node_t *node;
+    nonleaf_t *s;
+    leaf_t *leaf;
+
+    if( !tree->root ){
+        leaf = leaf_new( tree );
+        tree->root = &leaf->node;
     }
-    
-    node->n--;
-    
-    return;
-}
 
-static node_t *
-_pre_descend_child( bpt_t *tree, node_t *parent, int idx )
-{
-    node_t *child = NULL;
-    node_t *lsibling = NULL;
-    node_t *rsibling = NULL;
-    nonleaf_t *nln_parent;
-    nonleaf_t *nln_child, *nln_lsibling, *nln_rsibling;
+    while( pos < n ){
+        for( l=h-1; l>=0; l-- )
+            if( keys[pos] <= ub[l] && !_node_full( tree, path[l] ) )
+                break;
+
+        if( l < 0 ){
+            if( _node_full( tree, tree->root ) ){
+                s = non_leaf_new( tree );
+                s->children[0] = tree->root;
+                tree->root = &s->node;
+                _split_child( tree, &s->node, 0 );
+            }
+            l = 0;
+            path[0] = tree->root;
+            ub[0] = LLONG_MAX;
+        }
 
-    int parent_key, predecessor_key, successor_key;
-    
-    int t = tree->b_factor;
+        h = l + 1;
+        node = path[l];
 
-    nln_parent = (nonleaf_t *)parent;
+        while( node->type == BPLUS_TREE_NON_LEAF ){
+            STAT_INC( tree, put_visits );
+            i = _first_geq( node, keys[pos] );
+            if( _node_full( tree, ((nonleaf_t *)node)->children[i] ) ){
+                _split_child( tree, node, i );
+                if( keys[pos] > node->key[i] )
+                    i++;
+            }
+            assert( h < MAX_LEVEL );
+            path[h] = ((nonleaf_t *)node)->children[i];
+            ub[h] = i < node->n ? node->key[i] : ub[h-1];
+            node = path[h++];
+        }
 
-    child = nln_parent->children[idx]; 
-    
-    if( child->n>t-1 ) // not a minimal node
-        return child;
+        STAT_INC( tree, put_visits );
+        room = 2*tree->b_leaf-1 - node->n;
+        for( m=0; m<room && pos+m<n && keys[pos+m]<=ub[h-1]; m++ )
+            ;
+        assert( m > 0 );
 
-    if ( idx == parent->n ){   
-        lsibling = nln_parent->children[idx-1];
-        rsibling = NULL; 
-    }else if ( idx == 0 ) {
-        lsibling = NULL;
-        rsibling = nln_parent->children[1];
-    }else {
-        lsibling = nln_parent->children[idx - 1]; 
-        rsibling = nln_parent->children[idx + 1];
+        _leaf_merge( node, keys+pos, data+pos, m );
+        pos += m;
     }
-    
-    if( lsibling && lsibling->n > t-1 ){ 
-        assert(idx>0);
-        
-        predecessor_key = lsibling->key[lsibling->n-1];
+}
 
-        if( child->type == BPLUS_TREE_LEAF ){
-            parent->key[idx-1] = lsibling->key[lsibling->n-2];
-            _move_key( predecessor_key, lsibling, child, 1, 1 );
+/*
+ * Insert n pairs as n calls to bptPut would. The batch is sorted first
+ * unless it already is, so that the keys bound for one leaf are merged
+ * into it together and descents resume from the path of the last one.
+ * With a log attached the whole batch shares one commit. In concurrent
+ * mode the pairs are put one at a time. Returns as bptPut does.
+ */
+int
+bptPutBatch( bpt_t *tree, int *keys, int *data, int n )
+{
+    int i, sorted = 1;
+    int *sk = keys, *sd = data;
+    unsigned long long lsn = 0;
+
+    _unpack( tree );
+    if( tree->snap ){
+        printf("Snapshot is read-only! No insertion\n");
+        return -1;
+    }
+
+    if( n <= 0 )
+        return 0;
+
+    if( tree->wal )
+        lsn = walAppendBatch( tree->wal, WAL_PUT, keys, data, n );
+
+    if( tree->concurrent ){
+        for( i=0; i<n; i++ )
+            _put( tree, keys[i], data[i] );
+    }
+    else{
+        for( i=1; i<n && sorted; i++ )
+            sorted = keys[i-1] <= keys[i];
+
+        if( !sorted ){
+            sk = (int *)malloc( n * sizeof(int) );
+            sd = (int *)malloc( n * sizeof(int) );
+            assert( sk && sd );
+            _batch_sort( keys, data, sk, sd, n );
         }
-        else{
-            parent_key = parent->key[idx-1];
-            if( parent_key != child->key[0] )
-                _move_key( parent_key, parent, child, 0, 1 );//move 1-level down
-            //parent->key[idx-1] = lsibling->key[lsibling->n-1];
 
-            nln_child = (nonleaf_t *)child;
-            nln_lsibling = (nonleaf_t *)lsibling;
-            nln_child->children[0] = nln_lsibling->children[lsibling->n];
-            
-            _move_key( predecessor_key, lsibling, parent, 0, 0 );
+        STAT_ADD( tree, puts, n );
+        _thaw( tree );
+        _put_sorted( tree, sk, sd, n );
+
+        if( !sorted ){
+            free( sk );
+            free( sd );
         }
     }
-    else if( rsibling && rsibling->n > t-1 ){
-        
-        successor_key = rsibling->key[0];
 
-        if( child->type == BPLUS_TREE_LEAF ){
-            parent->key[idx] = successor_key;
+    if( tree->wal )
+        return _wal_commit( tree, lsn );
+
+    return 0;
+}
+
+/*
+ * Insert or update key in one descent, returning the value it had or
+ * DATA_NOT_EXIST. The descent remembers the deepest non-full node on
+ * the path; a new key that finds its leaf full is inserted from there,
+ * so only the full nodes below it are split, and nothing is split when
+ * the key already exists.
+ */
+static int
+_upsert( bpt_t *tree, int key, int data, int mode )
+{
+    int i, old;
+    node_t *node, *low = NULL;
+    leaf_t *ln;
+
+    STAT_INC( tree, puts );
+    _thaw( tree );
+
+    if( tree->concurrent ){
+        epochEnter( &tree->epoch );
+        old = _olc_put( tree, key, data, mode );
+        epochExit( &tree->epoch );
+        return old;
+    }
+
+    node = tree->root;
+
+    if( !node ){
+        if( mode != PUT_REPLACE )
+            _put( tree, key, data );
+        return DATA_NOT_EXIST;
+    }
+
+    while( node->type == BPLUS_TREE_NON_LEAF ){
+        STAT_INC( tree, put_visits );
+        if( !_node_full( tree, node ) )
+            low = node;
+        i = key_search( node->key, node->n, key );
+        if( i < 0 )
+            i = -i - 1;
+        node = ((nonleaf_t *)node)->children[i];
+    }
+
+    STAT_INC( tree, put_visits );
+    ln = (leaf_t *)node;
+    i = key_search( node->key, node->n, key );
+    if( i >= 0 ){
+        old = ln->data[i];
+        if( mode != PUT_IF_ABSENT )
+            ln->data[i] = data;
+        return old;
+    }
+
+    if( mode == PUT_REPLACE )
+        return DATA_NOT_EXIST;
+
+    if( !_node_full( tree, node ) )
+        _insert_nonfull( tree, node, key, data );
+    else if( low )
+        _insert_nonfull( tree, low, key, data );
+    else
+        _put( tree, key, data );
+
+    return DATA_NOT_EXIST;
+}
+
+/*
+ * Store the value key had, or DATA_NOT_EXIST, in *old unless old is
+ * NULL. Returns as bptPut does.
+ */
+static int
+_upsert_logged( bpt_t *tree, int key, int data, int mode, int *old )
+{
+    int prev, r = 0;
+    unsigned long long lsn;
+
+    _unpack( tree );
+    if( tree->snap ){
+        printf("Snapshot is read-only! No insertion\n");
+        prev = DATA_NOT_EXIST;
+        r = -1;
+    }
+    else if( tree->wal ){
+        lsn = walAppend( tree->wal, mode, key, data );
+        prev = _upsert( tree, key, data, mode );
+        r = _wal_commit( tree, lsn );
+    }
+    else
+        prev = _upsert( tree, key, data, mode );
+
+    if( old )
+        *old = prev;
+
+    return r;
+}
+
+/* set key to data, adding it if missing; *old gets the previous value */
+int
+bptUpsert( bpt_t *tree, int key, int data, int *old )
+{
+    return _upsert_logged( tree, key, data, PUT_UPSERT, old );
+}
+
+/* add key only if missing; *old gets its current value if present */
+int
+bptInsertIfAbsent( bpt_t *tree, int key, int data, int *old )
+{
+    return _upsert_logged( tree, key, data, PUT_IF_ABSENT, old );
+}
+
+/* set key to data only if present; *old gets the previous value */
+int
+bptReplace( bpt_t *tree, int key, int data, int *old )
+{
+    return _upsert_logged( tree, key, data, PUT_REPLACE, old );
+}
+
+/*
+ * Number of nodes to spread total entries over, each holding about
+ * per of them and none fewer than min. Dropping one node when the last
+ * would fall short keeps every node below 2*min+1 entries.
+ */
+static int
+_bulk_nodes( int total, int per, int min )
+{
+    int cnt = ( total + per - 1 ) / per;
+
+    if( cnt > 1 && total / cnt < min )
+        cnt--;
+
+    return cnt;
+}
+
+static int
+_bulk_per( double fill, int min, int max )
+{
+    int per = (int)( fill * max + 0.5 );
+
+    if( per < min )
+        per = min;
+    if( per > max )
+        per = max;
+
+    return per;
+}
+
+/*
+ * Build the empty tree bottom-up from n > 0 pairs sorted by key, with
+ * a learned model over the leaves if learn is set and bptSetLearned
+ * asked for one.
+ */
+static void
+_bulk_load( bpt_t *tree, int *keys, int *data, int n, double fill_factor, int learn )
+{
+    int i, j, k, cnt, total, nnodes, per;
+    int t = tree->b_leaf;
+    node_t **level;
+    int *hi;
+    leaf_t *ln, *prev = NULL;
+    nonleaf_t *nln;
+
+    per = _bulk_per( fill_factor, t, 2*t-1 );
+    nnodes = _bulk_nodes( n, per, t-1 );
+
+    level = (node_t **)malloc( nnodes * sizeof(node_t *) );
+    hi = (int *)malloc( nnodes * sizeof(int) );
+    assert( level && hi );
+
+    for( i=0, k=0; i<nnodes; i++ ){
+        ln = leaf_new(tree);
+        cnt = n/nnodes + ( i < n%nnodes );
+
+        for( j=0; j<cnt; j++, k++ ){
+            assert( k==0 || keys[k-1] <= keys[k] );
+            ln->node.key[j] = keys[k];
+            ln->data[j] = data[k];
+        }
+        ln->node.n = cnt;
+
+        if( prev )
+            prev->next = ln;
+        prev = ln;
+
+        level[i] = &ln->node;
+        hi[i] = keys[k-1];
+    }
+
+    //the leaf level is complete, train the model before it is overwritten
+    if( learn && tree->learn_eps && !tree->concurrent )
+        tree->model = plmBuild( hi, (void **)level, nnodes, tree->learn_eps );
+
+    t = tree->b_inner;
+    per = _bulk_per( fill_factor, t+1, 2*t );
+
+    while( nnodes > 1 ){
+        total = nnodes;
+        nnodes = _bulk_nodes( total, per, t );
+
+        //parents are written in place over the level below
+        for( i=0, k=0; i<nnodes; i++ ){
+            nln = non_leaf_new(tree);
+            cnt = total/nnodes + ( i < total%nnodes );
+
+            for( j=0; j<cnt; j++, k++ ){
+                nln->children[j] = level[k];
+                if( j>0 )
+                    nln->node.key[j-1] = hi[k-1];
+            }
+            nln->node.n = cnt-1;
+
+            level[i] = &nln->node;
+            hi[i] = hi[k-1];
+        }
+    }
+
+    tree->root = level[0];
+
+    free( hi );
+    free( level );
+}
+
+/*
+ * Build the tree bottom-up from n pairs sorted by key. Leaves are
+ * packed left to right to fill_factor of their capacity and linked,
+ * then each non-leaf level is built over the one below it. A learned
+ * model is trained over the new leaves if bptSetLearned asked for one.
+ * The tree must be empty.
+ */
+int
+bptBulkLoad( bpt_t *tree, int *keys, int *data, int n, double fill_factor )
+{
+    if( tree->root || tree->snap ){
+        printf("Tree is not empty! No bulk load\n");
+        return -1;
+    }
+
+    if( n <= 0 )
+        return 0;
+
+    _bulk_load( tree, keys, data, n, fill_factor, 1 );
+
+    //bulk loads are not logged, the checkpoint covers them
+    if( tree->wal )
+        return bptCheckpoint( tree );
+
+    return 0;
+}
+
+#define BUILD_THREADS_MAX (64)
+#define BUILD_MIN_PER_THREAD (1<<14)
+
+/* state shared by the threads of bptBuildParallel */
+typedef struct build {
+    bpt_t *tree;
+    int n;
+    int nthreads;
+    const int *keys;
+    const int *data;
+    int *rk;                            //sorted runs, one per thread
+    int *rd;
+    int *sk;                            //all pairs in key order
+    int *sd;
+    int split[BUILD_THREADS_MAX];       //thread i merges keys in [split[i], split[i+1])
+    int total;                          //nodes on the level below
+    int nnodes;                         //nodes on the level being built
+    node_t **level;
+    int *hi;
+    node_t **up;
+    int *up_hi;
+}build_t;
+
+/* one thread's share of a build, with its own node arenas */
+typedef struct build_arg {
+    build_t *b;
+    int id;
+    slab_t leaf_pool;
+    slab_t non_leaf_pool;
+}build_arg_t;
+
+/* index of the first of cnt items in an even split of total into parts */
+static inline long
+_build_first( long total, long parts, long i )
+{
+    return i * ( total / parts ) + ( i < total % parts ? i : total % parts );
+}
+
+static int
+_lower_bound( const int *a, int n, int key )
+{
+    int lo = 0, hi = n, mid;
+
+    while( lo < hi ){
+        mid = ( lo + hi ) / 2;
+        if( a[mid] < key )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* sort this thread's slice of the input into its run */
+static void *
+_build_sort( void *arg )
+{
+    build_arg_t *a = (build_arg_t *)arg;
+    build_t *b = a->b;
+    int lo = _build_first( b->n, b->nthreads, a->id );
+    int cnt = _build_first( b->n, b->nthreads, a->id+1 ) - lo;
+    int i;
+
+    for( i=1; i<cnt && b->keys[lo+i-1] <= b->keys[lo+i]; i++ )
+        ;
+
+    if( i >= cnt ){
+        memcpy( b->rk+lo, b->keys+lo, cnt * sizeof(int) );
+        memcpy( b->rd+lo, b->data+lo, cnt * sizeof(int) );
+    }
+    else
+        _batch_sort( b->keys+lo, b->data+lo, b->rk+lo, b->rd+lo, cnt );
+
+    return NULL;
+}
+
+/*
+ * Merge this thread's key range out of every run. Its output starts
+ * after all the smaller keys of all runs, so threads write disjoint
+ * parts of sk/sd. Ties go to the lower run, which keeps equal keys in
+ * input order.
+ */
+static void *
+_build_merge( void *arg )
+{
+    build_arg_t *a = (build_arg_t *)arg;
+    build_t *b = a->b;
+    int pos[BUILD_THREADS_MAX], end[BUILD_THREADS_MAX];
+    int i, r, lo, cnt, out = 0, best;
+
+    for( r=0; r<b->nthreads; r++ ){
+        lo = _build_first( b->n, b->nthreads, r );
+        cnt = _build_first( b->n, b->nthreads, r+1 ) - lo;
+        pos[r] = lo + ( a->id == 0 ? 0 : _lower_bound( b->rk+lo, cnt, b->split[a->id] ) );
+        end[r] = lo + ( a->id == b->nthreads-1 ? cnt : _lower_bound( b->rk+lo, cnt, b->split[a->id+1] ) );
+        out += pos[r] - lo;
+    }
+
+    for( ;; ){
+        best = -1;
+        for( r=0; r<b->nthreads; r++ ){
+            if( pos[r] < end[r] && ( best < 0 || b->rk[pos[r]] < b->rk[pos[best]] ) )
+                best = r;
+        }
+        if( best < 0 )
+            break;
+
+        i = pos[best]++;
+        b->sk[out] = b->rk[i];
+        b->sd[out] = b->rd[i];
+        out++;
+    }
+
+    return NULL;
+}
+
+/* fill this thread's run of leaves and link them to each other */
+static void *
+_build_leaves( void *arg )
+{
+    build_arg_t *a = (build_arg_t *)arg;
+    build_t *b = a->b;
+    int first = _build_first( b->nnodes, b->nthreads, a->id );
+    int last = _build_first( b->nnodes, b->nthreads, a->id+1 );
+    int i, k, cnt;
+    leaf_t *ln, *prev = NULL;
+
+    for( i=first; i<last; i++ ){
+        ln = _leaf_init( b->tree, slabAlloc( &a->leaf_pool ) );
+        k = _build_first( b->n, b->nnodes, i );
+        cnt = _build_first( b->n, b->nnodes, i+1 ) - k;
+
+        memcpy( ln->node.key, b->sk+k, cnt * sizeof(int) );
+        memcpy( ln->data, b->sd+k, cnt * sizeof(int) );
+        ln->node.n = cnt;
+
+        if( prev )
+            prev->next = ln;
+        prev = ln;
+
+        b->level[i] = &ln->node;
+        b->hi[i] = b->sk[k+cnt-1];
+    }
+
+    return NULL;
+}
+
+/* build this thread's share of the parents of the level below */
+static void *
+_build_parents( void *arg )
+{
+    build_arg_t *a = (build_arg_t *)arg;
+    build_t *b = a->b;
+    int first = _build_first( b->nnodes, b->nthreads, a->id );
+    int last = _build_first( b->nnodes, b->nthreads, a->id+1 );
+    int i, j, k, cnt;
+    nonleaf_t *nln;
+
+    for( i=first; i<last; i++ ){
+        nln = _non_leaf_init( b->tree, slabAlloc( &a->non_leaf_pool ) );
+        k = _build_first( b->total, b->nnodes, i );
+        cnt = _build_first( b->total, b->nnodes, i+1 ) - k;
+
+        for( j=0; j<cnt; j++ ){
+            nln->children[j] = b->level[k+j];
+            if( j>0 )
+                nln->node.key[j-1] = b->hi[k+j-1];
+        }
+        nln->node.n = cnt-1;
+
+        b->up[i] = &nln->node;
+        b->up_hi[i] = b->hi[k+cnt-1];
+    }
+
+    return NULL;
+}
+
+/*
+ * Run fn on nthreads threads, the calling thread being the first. A
+ * share whose thread cannot be created is run by the caller instead.
+ */
+static void
+_build_run( build_arg_t *args, int nthreads, void *(*fn)( void * ) )
+{
+    int i;
+    int err[BUILD_THREADS_MAX];
+    pthread_t th[BUILD_THREADS_MAX];
+
+    for( i=1; i<nthreads; i++ ){
+        err[i] = pthread_create( &th[i], NULL, fn, &args[i] );
+        if( err[i] )
+            fn( &args[i] );
+    }
+    fn( &args[0] );
+    for( i=1; i<nthreads; i++ )
+        if( !err[i] )
+            pthread_join( th[i], NULL );
+}
+
+static int
+_int_cmp( const void *a, const void *b )
+{
+    int x = *(const int *)a, y = *(const int *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Build the tree from n unsorted pairs on up to nthreads threads.
+ * Every thread radix-sorts a slice of the input; splitters sampled
+ * from the sorted runs then give each thread a key range to merge out
+ * of all runs. The leaves, packed full, are cut into one run per
+ * thread, each allocated from that thread's own slabs, and the runs'
+ * next pointers are stitched together afterwards. Each non-leaf level
+ * is split among the threads the same way. The arenas are handed to
+ * the tree at the end. The result is the tree bptBulkLoad would build
+ * from the sorted pairs. The tree must be empty.
+ */
+int
+bptBuildParallel( bpt_t *tree, int *keys, int *data, int n, int nthreads )
+{
+    int i, j, p, per, t, *samples, *tmp_hi;
+    node_t **tmp;
+    build_t b;
+    build_arg_t *args;
+
+    if( tree->root || tree->snap ){
+        printf("Tree is not empty! No parallel build\n");
+        return -1;
+    }
+
+    if( n <= 0 )
+        return 0;
+
+    p = n / BUILD_MIN_PER_THREAD;
+    if( p > nthreads )
+        p = nthreads;
+    if( p > BUILD_THREADS_MAX )
+        p = BUILD_THREADS_MAX;
+    if( p < 1 )
+        p = 1;
+
+    b.tree = tree;
+    b.n = n;
+    b.nthreads = p;
+    b.keys = keys;
+    b.data = data;
+    b.rk = (int *)malloc( n * sizeof(int) );
+    b.rd = (int *)malloc( n * sizeof(int) );
+    b.sk = (int *)malloc( n * sizeof(int) );
+    b.sd = (int *)malloc( n * sizeof(int) );
+    args = (build_arg_t *)malloc( p * sizeof(build_arg_t) );
+    samples = (int *)malloc( p * p * sizeof(int) );
+    assert( b.rk && b.rd && b.sk && b.sd && args && samples );
+
+    for( i=0; i<p; i++ ){
+        args[i].b = &b;
+        args[i].id = i;
+        slabInit( &args[i].leaf_pool, tree->leaf_pool.size, NODES_PER_SLAB );
+        slabInit( &args[i].non_leaf_pool, tree->non_leaf_pool.size, NODES_PER_SLAB );
+    }
+
+    _build_run( args, p, _build_sort );
+
+    //p regular samples from each run, every p-th of them a splitter
+    for( i=0; i<p; i++ ){
+        t = _build_first( n, p, i+1 ) - _build_first( n, p, i );
+        for( j=0; j<p; j++ )
+            samples[i*p+j] = b.rk[ _build_first( n, p, i ) + (long)t * j / p ];
+    }
+    qsort( samples, p*p, sizeof(int), _int_cmp );
+    for( i=1; i<p; i++ )
+        b.split[i] = samples[i*p + p/2];
+
+    _build_run( args, p, _build_merge );
+
+    free( samples );
+    free( b.rk );
+    free( b.rd );
+
+    t = tree->b_leaf;
+    per = _bulk_per( 1.0, t, 2*t-1 );
+    b.nnodes = _bulk_nodes( n, per, t-1 );
+    b.level = (node_t **)malloc( b.nnodes * sizeof(node_t *) );
+    b.hi = (int *)malloc( b.nnodes * sizeof(int) );
+    b.up = (node_t **)malloc( b.nnodes * sizeof(node_t *) );
+    b.up_hi = (int *)malloc( b.nnodes * sizeof(int) );
+    assert( b.level && b.hi && b.up && b.up_hi );
+
+    b.nthreads = p < b.nnodes ? p : b.nnodes;
+    _build_run( args, b.nthreads, _build_leaves );
+
+    //stitch the leaf runs together
+    for( i=1; i<b.nthreads; i++ ){
+        j = _build_first( b.nnodes, b.nthreads, i );
+        ((leaf_t *)b.level[j-1])->next = (leaf_t *)b.level[j];
+    }
+
+    if( tree->learn_eps && !tree->concurrent )
+        tree->model = plmBuild( b.hi, (void **)b.level, b.nnodes, tree->learn_eps );
+
+    t = tree->b_inner;
+    per = _bulk_per( 1.0, t+1, 2*t );
+
+    while( b.nnodes > 1 ){
+        b.total = b.nnodes;
+        b.nnodes = _bulk_nodes( b.total, per, t );
+        b.nthreads = p < b.nnodes ? p : b.nnodes;
+        _build_run( args, b.nthreads, _build_parents );
+
+        tmp = b.level; b.level = b.up; b.up = tmp;
+        tmp_hi = b.hi; b.hi = b.up_hi; b.up_hi = tmp_hi;
+    }
+
+    tree->root = b.level[0];
+
+    pthread_mutex_lock( &tree->pool_lock );
+    for( i=0; i<p; i++ ){
+        slabAdopt( &tree->leaf_pool, &args[i].leaf_pool );
+        slabAdopt( &tree->non_leaf_pool, &args[i].non_leaf_pool );
+    }
+    pthread_mutex_unlock( &tree->pool_lock );
+
+    free( args );
+    free( b.sk );
+    free( b.sd );
+    free( b.level );
+    free( b.hi );
+    free( b.up );
+    free( b.up_hi );
+
+    //like bulk loads, builds are not logged
+    if( tree->wal )
+        return bptCheckpoint( tree );
+
+    return 0;
+}
+
+static void 
+_node_key_shift_left( node_t *node, int index, int ptr_shift) 
+{
+    int idx;
+    nonleaf_t *nln;
+    leaf_t *ln;
+    
+    if( node->type == BPLUS_TREE_LEAF ){
+        ln = (leaf_t *)node;
+        for( idx=index; idx<node->n-1; idx++ ){
+            node->key[idx] = node->key[idx+1];
+            ln->data[idx] = ln->data[idx+1];
+        }
+
+    }
+    else{ 
+
+        nln = (nonleaf_t *)node;
+
+        for( idx=index; idx<node->n-1; idx++ ){
+            node->key[idx] = node->key[idx+1];
+            if( ptr_shift )
+                nln->children[idx]=nln->children[idx+1];
+        }
+
+        if( ptr_shift )
+            nln->children[node->n-1]=nln->children[node->n];
+    }
+
+    node->n--;
+}
+
+static void 
+_node_key_shift_right( node_t *node, int index, int ptr_shift )
+{
+
+    int idx;
+    nonleaf_t *nln;
+    leaf_t *ln;
+    
+    assert( index<=node->n );
+    
+    if( node->type == BPLUS_TREE_LEAF ){
+        ln = (leaf_t *)node;
+        for( idx=node->n; idx>index; idx-- ){
+            node->key[idx] = node->key[idx-1];
+            ln->data[idx] = ln->data[idx-1];
+        }
+    }
+    else{
+        nln = (nonleaf_t *)node;
+
+        for( idx=node->n; idx>index; idx-- ){
+            node->key[idx] = node->key[idx-1];
+            if( ptr_shift )
+                nln->children[idx+1]=nln->children[idx]; 
+        } 
+ 
+        if( ptr_shift )
+            nln->children[idx+1]=nln->children[idx]; 
+    }
+    
+    node->key[index] = INVALID_KEY;
+    
+    node->n++;
+}
+
+static void 
+_move_key( int key, node_t *src, node_t *dest, int src_ptr_shift, int dest_ptr_shift )
+{
+    int src_pos = 0;
+    int dest_pos = 0;
+
+    while( src_pos<src->n && key>src->key[src_pos] )
+        src_pos++;
+    
+    while( dest_pos<dest->n && key>dest->key[dest_pos] )
+        dest_pos++;
+    
+    _node_key_shift_right( dest, dest_pos, dest_ptr_shift );
+    
+    dest->key[ dest_pos ] = src->key[src_pos]; 
+
+    if( dest->type == BPLUS_TREE_LEAF )
+        ((leaf_t *)dest)->data[ dest_pos ] = ((leaf_t *)src)->data[src_pos]; 
+    
+    _node_key_shift_left( src, src_pos, src_ptr_shift );
+    
+    //DISK_WRITE(src);
+    //DISK_WRITE(dest);
+}
+
+static void 
+_merge_node( bpt_t *tree, node_t *left, node_t *right )
+{
+    int k;
+    nonleaf_t *l_nln = NULL, *r_nln = NULL;
+    leaf_t *l_ln = NULL, *r_ln = NULL;
+    
+    assert( left->type == right->type );
+
+    STAT_INC( tree, merges );
+
+    if( left->type == BPLUS_TREE_LEAF ){
+        l_ln = (leaf_t *) left;
+        r_ln = (leaf_t *) right;
+    }
+    else{
+        l_nln = (nonleaf_t *) left;
+        r_nln = (nonleaf_t *) right;
+    }
+
+    if( left->type == BPLUS_TREE_LEAF ){
+        for( k=0; k<right->n; k++ ){
+            left->key[left->n+k] = right->key[k];
+            l_ln->data[left->n+k] = r_ln->data[k];
+        }
+    }
+    else{ 
+        for( k=0; k<right->n; k++ ){
+            left->key[left->n+k] = right->key[k];
+            l_nln->children[left->n+k] = r_nln->children[k];
+        }
+    
+        l_nln->children[left->n+right->n] = r_nln->children[right->n];
+    }
+    
+    left->n += right->n;
+
+    if( left->type == BPLUS_TREE_LEAF )
+        l_ln->next = r_ln->next;
+    
+    if( right->type==BPLUS_TREE_NON_LEAF )
+        non_leaf_destroy(tree, &r_nln);
+    else
+        leaf_destroy(tree, &r_ln);
+    
+    //DISK_WRITE(left);
+    //DISK_WRITE(right);
+}
+
+static void
+_remove_from_leaf( node_t *node, int idx )
+{
+    int i = idx;
+    leaf_t *ln = (leaf_t *)node;
+    
+    assert( node->type == BPLUS_TREE_LEAF);
+    assert( idx<node->n );
+    
+    while( i<node->n-1 ){
+        node->key[i] = node->key[i+1];
+        ln->data[i] = ln->data[i+1];
+        i++;
+    }
+    
+    node->n--;
+    
+    return;
+}
+
+static node_t *
+_pre_descend_child( bpt_t *tree, node_t *parent, int idx )
+{
+    node_t *child = NULL;
+    node_t *lsibling = NULL;
+    node_t *rsibling = NULL;
+    nonleaf_t *nln_parent;
+    nonleaf_t *nln_child, *nln_lsibling, *nln_rsibling;
+
+    int predecessor_key, successor_key;
+    
+    int t;
+
+    nln_parent = (nonleaf_t *)parent;
+
+    child = nln_parent->children[idx]; 
+    t = _node_b( tree, child );
+    
+    if( child->n>t-1 ) // not a minimal node
+        return child;
+
+    if ( idx == parent->n ){   
+        lsibling = nln_parent->children[idx-1];
+        rsibling = NULL; 
+    }else if ( idx == 0 ) {
+        lsibling = NULL;
+        rsibling = nln_parent->children[1];
+    }else {
+        lsibling = nln_parent->children[idx - 1]; 
+        rsibling = nln_parent->children[idx + 1];
+    }
+    
+    if( lsibling && lsibling->n > t-1 ){ 
+        assert(idx>0);
+        STAT_INC( tree, borrows_left );
+        
+        predecessor_key = lsibling->key[lsibling->n-1];
+
+        if( child->type == BPLUS_TREE_LEAF ){
+            parent->key[idx-1] = lsibling->key[lsibling->n-2];
+            _move_key( predecessor_key, lsibling, child, 1, 1 );
+        }
+        else{
+            //rotate through the parent by position: with repeated keys
+            //a separator can equal its neighbours
+            nln_child = (nonleaf_t *)child;
+            nln_lsibling = (nonleaf_t *)lsibling;
+
+            _node_key_shift_right( child, 0, 1 );
+            child->key[0] = parent->key[idx-1];
+            nln_child->children[0] = nln_lsibling->children[lsibling->n];
+
+            parent->key[idx-1] = predecessor_key;
+            lsibling->n--;
+        }
+    }
+    else if( rsibling && rsibling->n > t-1 ){
+        STAT_INC( tree, borrows_right );
+        
+        successor_key = rsibling->key[0];
+
+        if( child->type == BPLUS_TREE_LEAF ){
+            parent->key[idx] = successor_key;
             _move_key( successor_key, rsibling, child, 1, 1 );
         }
-        else{
-            parent_key = parent->key[idx];
-            if( parent_key != child->key[child->n-1] )
-                _move_key( parent_key, parent, child, 0, 1 );//move 1-level down
-            //parent->key[idx] = successor_key;
+        else{
+            nln_child = (nonleaf_t *)child;
+            nln_rsibling = (nonleaf_t *)rsibling;
+
+            child->key[child->n] = parent->key[idx];
+            nln_child->children[child->n+1] = nln_rsibling->children[0];
+            child->n++;
+
+            parent->key[idx] = successor_key;
+            _node_key_shift_left( rsibling, 0, 1 );
+        }
+
+    }
+    else if( lsibling && (lsibling->n <= t-1) ){
+        assert(idx>0);
+        
+        //a non-leaf merge pulls the separator down between the halves
+        if( child->type == BPLUS_TREE_NON_LEAF )
+            lsibling->key[lsibling->n++] = parent->key[idx-1];
+        _node_key_shift_left( parent, idx-1, 1 );
+
+        _merge_node( tree, lsibling, child );
+        nln_parent->children[idx-1] = lsibling;
+        
+        child = lsibling;
+    }
+    else if( rsibling && (rsibling->n <= t-1) ){
+        
+        if( child->type == BPLUS_TREE_NON_LEAF )
+            child->key[child->n++] = parent->key[idx];
+        _node_key_shift_left( parent, idx, 1 );
+
+        _merge_node( tree, child, rsibling );
+        nln_parent->children[idx] = child;
+    }
+    else
+        assert(0);
+    
+    return child;
+}
+
+
+static void
+_descend( bpt_t *tree, node_t *node, int key )
+{
+    int i;
+    nonleaf_t *nln;
+    leaf_t *ln;
+    node_t *child;
+
+    STAT_INC( tree, remove_visits );
+
+    i = key_search(node->key, node->n, key);
+
+    if( i>= 0 ){ //key found in node 
+        if( node->type == BPLUS_TREE_LEAF ){
+            _remove_from_leaf( node, i );
+            if( node->n==0 && node==tree->root ){
+                ln = (leaf_t *)node;
+                leaf_destroy(tree, &ln);
+                tree->root = NULL;
+            }
+            return;
+        }
+    }
+        
+    //key not found in the node
+    if( node->type == BPLUS_TREE_LEAF ){
+        printf(" The key %d does not exist in the tree\n", key );
+        return;
+    }
+    
+    assert( node->type == BPLUS_TREE_NON_LEAF );
+
+    nln = (nonleaf_t *)node;
+    
+    if (i < 0) 
+        i = -i - 1;
+
+    child = _pre_descend_child( tree, node, i );
+    
+    _descend( tree, child, key );
+    
+    if( node->n==0 && node==tree->root ){
+        non_leaf_destroy(tree, &nln);
+        tree->root = child;
+    }
+    
+    return;
+}
+
+/*
+ * Deletion without rebalancing: the key is looked up first and removed
+ * from its leaf, and nothing else changes unless that empties the leaf.
+ * An empty leaf is unlinked from the leaf chain and from its parent,
+ * and a parent left without children goes the same way. Non-leaves
+ * may end up with a single child; only the root is collapsed.
+ */
+static void
+_relaxed_remove( bpt_t *tree, int key )
+{
+    int h = 0, l, i;
+    int idx[MAX_LEVEL];
+    node_t *path[MAX_LEVEL];
+    node_t *node = tree->root, *prev;
+    nonleaf_t *nln;
+    leaf_t *ln;
+
+    while( node->type == BPLUS_TREE_NON_LEAF ){
+        STAT_INC( tree, remove_visits );
+        i = key_search( node->key, node->n, key );
+        if( i < 0 )
+            i = -i - 1;
+        assert( h < MAX_LEVEL );
+        path[h] = node;
+        idx[h++] = i;
+        node = ((nonleaf_t *)node)->children[i];
+    }
+
+    STAT_INC( tree, remove_visits );
+    i = key_search( node->key, node->n, key );
+    if( i < 0 ){
+        printf(" The key %d does not exist in the tree\n", key );
+        return;
+    }
+
+    _remove_from_leaf( node, i );
+    if( node->n > 0 )
+        return;
+
+    //the leaf before this one is the rightmost leaf left of the path
+    ln = (leaf_t *)node;
+    for( l=h-1; l>=0 && idx[l]==0; l-- )
+        ;
+    if( l >= 0 ){
+        prev = ((nonleaf_t *)path[l])->children[idx[l]-1];
+        while( prev->type == BPLUS_TREE_NON_LEAF )
+            prev = ((nonleaf_t *)prev)->children[prev->n];
+        ((leaf_t *)prev)->next = ln->next;
+    }
+    leaf_destroy( tree, &ln );
+
+    for( l=h-1; l>=0; l-- ){
+        node = path[l];
+        if( node->n > 0 ){
+            //the range of the removed child joins a neighbour's
+            if( idx[l] < node->n )
+                _node_key_shift_left( node, idx[l], 1 );
+            else
+                node->n--;
+            break;
+        }
+        nln = (nonleaf_t *)node;
+        non_leaf_destroy( tree, &nln );
+    }
+
+    if( l < 0 ){
+        tree->root = NULL;
+        return;
+    }
+
+    while( tree->root->type == BPLUS_TREE_NON_LEAF && tree->root->n == 0 ){
+        nln = (nonleaf_t *)tree->root;
+        tree->root = nln->children[0];
+        non_leaf_destroy( tree, &nln );
+    }
+}
+
+static void
+_remove( bpt_t *tree, int key ){
+
+    STAT_INC( tree, removes );
+    _thaw( tree );
+    
+    if( tree->concurrent ){
+        epochEnter( &tree->epoch );
+        _olc_remove( tree, key );
+        epochExit( &tree->epoch );
+    }
+    else if( !tree->root )
+        printf("Empty tree! No deletion\n");
+    else if( tree->relaxed )
+        _relaxed_remove( tree, key );
+    else
+        _descend( tree, tree->root, key );
+}
+
+/* returns as bptPut does */
+int
+bptRemove( bpt_t *tree, int key ){
+
+    unsigned long long lsn;
+
+    _unpack( tree );
+    if( tree->snap ){
+        printf("Snapshot is read-only! No deletion\n");
+        return -1;
+    }
+
+    if( tree->wal ){
+        lsn = walAppend( tree->wal, WAL_REMOVE, key, 0 );
+        _remove( tree, key );
+        return _wal_commit( tree, lsn );
+    }
+
+    _remove( tree, key );
+    return 0;
+}
+
+/*
+ * Free a subtree that lies entirely inside a removed range and return
+ * the number of keys it held. The leaf chain is mended by the caller.
+ */
+static int
+_subtree_free( bpt_t *tree, node_t *node )
+{
+    int i, cnt = 0;
+    nonleaf_t *nln;
+    leaf_t *ln;
+
+    if( node->type == BPLUS_TREE_LEAF ){
+        cnt = node->n;
+        ln = (leaf_t *)node;
+        leaf_destroy( tree, &ln );
+        return cnt;
+    }
+
+    nln = (nonleaf_t *)node;
+    for( i=0; i<=node->n; i++ )
+        cnt += _subtree_free( tree, nln->children[i] );
+    non_leaf_destroy( tree, &nln );
+
+    return cnt;
+}
+
+/*
+ * Free the empty child c of node and drop it with one separator.
+ * Returns 1 if that was node's only child.
+ */
+static int
+_drop_child( bpt_t *tree, node_t *node, int c )
+{
+    nonleaf_t *nln = (nonleaf_t *)node;
+    nonleaf_t *child = (nonleaf_t *)nln->children[c];
+    leaf_t *ln = (leaf_t *)nln->children[c];
+
+    if( child->node.type == BPLUS_TREE_LEAF )
+        leaf_destroy( tree, &ln );
+    else
+        non_leaf_destroy( tree, &child );
+
+    if( node->n == 0 )
+        return 1;
+
+    if( c < node->n )
+        _node_key_shift_left( node, c, 1 );
+    else
+        node->n--;
+
+    return 0;
+}
+
+/*
+ * Remove the keys in [lo, hi] below node. Children lying between the
+ * one lo leads to and the one hi leads to are freed whole; only those
+ * two are descended into, and either is dropped if left empty. Nothing
+ * is rebalanced. Returns 1 if node itself is left empty.
+ */
+static int
+_remove_range_node( bpt_t *tree, node_t *node, int lo, int hi, int *removed )
+{
+    int i, j, k, d;
+    nonleaf_t *nln = (nonleaf_t *)node;
+    leaf_t *ln = (leaf_t *)node;
+
+    STAT_INC( tree, remove_visits );
+
+    i = _first_geq( node, lo );
+    j = _first_gt( node, hi );
+
+    if( node->type == BPLUS_TREE_LEAF ){
+        d = j - i;
+        for( k=j; k<node->n; k++ ){
+            node->key[k-d] = node->key[k];
+            ln->data[k-d] = ln->data[k];
+        }
+        node->n -= d;
+        *removed += d;
+        return node->n == 0;
+    }
+
+    //separator i still bounds child j from below once the children
+    //between them are gone
+    if( j > i+1 ){
+        for( k=i+1; k<j; k++ )
+            *removed += _subtree_free( tree, nln->children[k] );
+        d = j - i - 1;
+        for( k=j; k<node->n; k++ )
+            node->key[k-d] = node->key[k];
+        for( k=j; k<=node->n; k++ )
+            nln->children[k-d] = nln->children[k];
+        node->n -= d;
+        j = i + 1;
+    }
+
+    if( j > i && _remove_range_node( tree, nln->children[j], lo, hi, removed ) )
+        _drop_child( tree, node, j );
+
+    if( _remove_range_node( tree, nln->children[i], lo, hi, removed ) )
+        return _drop_child( tree, node, i );
+
+    return 0;
+}
+
+/*
+ * The leaf a descent for key reaches, going to the first separator
+ * >= key, or > key if upper is set. If prev is given it receives the
+ * leaf before that one, NULL for the first leaf.
+ */
+static leaf_t *
+_boundary_leaf( bpt_t *tree, int key, int upper, leaf_t **prev )
+{
+    int i;
+    node_t *node = tree->root, *before = NULL;
+
+    while( node->type == BPLUS_TREE_NON_LEAF ){
+        i = upper ? _first_gt( node, key ) : _first_geq( node, key );
+        if( i > 0 )
+            before = ((nonleaf_t *)node)->children[i-1];
+        node = ((nonleaf_t *)node)->children[i];
+    }
+
+    if( prev ){
+        while( before && before->type == BPLUS_TREE_NON_LEAF )
+            before = ((nonleaf_t *)before)->children[before->n];
+        *prev = (leaf_t *)before;
+    }
+
+    return (leaf_t *)node;
+}
+
+/*
+ * Rebalance the path a descent for key takes, as a deletion would, and
+ * collapse the root while it has a single child.
+ */
+static void
+_range_fix( bpt_t *tree, int key, int upper )
+{
+    int i;
+    node_t *node = tree->root, *child;
+    nonleaf_t *nln;
+
+    while( node && node->type == BPLUS_TREE_NON_LEAF ){
+        i = upper ? _first_gt( node, key ) : _first_geq( node, key );
+
+        if( node->n > 0 )
+            child = _pre_descend_child( tree, node, i );
+        else
+            child = ((nonleaf_t *)node)->children[0];
+
+        if( node == tree->root && node->n == 0 ){
+            nln = (nonleaf_t *)node;
+            non_leaf_destroy( tree, &nln );
+            tree->root = child;
+        }
+        node = child;
+    }
+}
+
+static int
+_remove_range( bpt_t *tree, int lo, int hi )
+{
+    int removed = 0;
+    int keep_a, keep_b;
+    leaf_t *prev, *a, *b, *next, *chain[2];
+    int k, nchain = 0;
+    nonleaf_t *nln;
+    leaf_t *ln;
+
+    _thaw( tree );
+
+    if( !tree->root || lo > hi )
+        return 0;
+
+    a = _boundary_leaf( tree, lo, 0, &prev );
+    b = _boundary_leaf( tree, hi, 1, NULL );
+    next = b->next;
+    keep_a = a->node.key[0] < lo || a->node.key[a->node.n-1] > hi;
+    keep_b = b != a && ( b->node.key[0] < lo || b->node.key[b->node.n-1] > hi );
+
+    if( _remove_range_node( tree, tree->root, lo, hi, &removed ) ){
+        if( tree->root->type == BPLUS_TREE_LEAF ){
+            ln = (leaf_t *)tree->root;
+            leaf_destroy( tree, &ln );
+        }
+        else{
+            nln = (nonleaf_t *)tree->root;
+            non_leaf_destroy( tree, &nln );
+        }
+        tree->root = NULL;
+        return removed;
+    }
+
+    //every leaf between a and b is gone; link around them
+    if( keep_a )
+        chain[nchain++] = a;
+    if( keep_b )
+        chain[nchain++] = b;
+    for( k=0; k<nchain; k++ ){
+        if( prev )
+            prev->next = chain[k];
+        prev = chain[k];
+    }
+    if( prev )
+        prev->next = next;
+
+    _range_fix( tree, lo, 0 );
+    _range_fix( tree, hi, 1 );
+
+    return removed;
+}
+
+/*
+ * Remove every key in [lo, hi] and return how many were removed. The
+ * two leaves at the ends of the range are trimmed, everything between
+ * them is freed without being visited key by key, and only the two
+ * paths to the ends are rebalanced. The nodes are changed and freed
+ * without locks, so a tree in concurrent mode is rejected. Returns -1
+ * for a snapshot or a concurrent tree, or if the log failed.
+ */
+int
+bptRemoveRange( bpt_t *tree, int lo, int hi )
+{
+    int removed;
+    unsigned long long lsn;
+
+    _unpack( tree );
+    if( tree->snap ){
+        printf("Snapshot is read-only! No deletion\n");
+        return -1;
+    }
+
+    if( tree->concurrent ){
+        printf("Range removal needs a private tree\n");
+        return -1;
+    }
+
+    if( tree->wal ){
+        lsn = walAppend( tree->wal, WAL_REMOVE_RANGE, lo, hi );
+        removed = _remove_range( tree, lo, hi );
+        if( _wal_commit( tree, lsn ) )
+            removed = -1;
+    }
+    else
+        removed = _remove_range( tree, lo, hi );
+
+    return removed;
+}
+
+/* clamp a key count read without a lock to the node's capacity */
+static inline int
+_olc_nkeys( bpt_t *tree, node_t *node )
+{
+    int n = node->n;
+    int max = 2*_node_b( tree, node )-1;
+
+    return n < 0 ? 0 : ( n > max ? max : n );
+}
+
+static inline int
+_olc_child_index( bpt_t *tree, node_t *node, int key )
+{
+    int i = key_search( node->key, _olc_nkeys( tree, node ), key );
+
+    return i < 0 ? -i - 1 : i;
+}
+
+/* _node_search without locks, validating every node it reads */
+static int
+_olc_get( bpt_t *tree, int key )
+{
+    int i, data;
+    unsigned long v, pv;
+    node_t *node, *child;
+
+restart:
+    if( !_olc_read_lock( &tree->root_version, &pv ) )
+        goto restart;
+
+    node = tree->root;
+    if( !node ){
+        if( !_olc_validate( &tree->root_version, pv ) )
+            goto restart;
+        return 0;
+    }
+
+    if( !_olc_read_lock( &node->version, &v ) || !_olc_validate( &tree->root_version, pv ) )
+        goto restart;
+
+    while( node->type == BPLUS_TREE_NON_LEAF ){
+        STAT_INC( tree, get_visits );
+        child = ((nonleaf_t *)node)->children[ _olc_child_index( tree, node, key ) ];
+
+        //the child pointer is only safe to follow once node is validated
+        if( !_olc_validate( &node->version, v ) )
+            goto restart;
+
+        pv = v;
+        if( !_olc_read_lock( &child->version, &v ) || !_olc_validate( &node->version, pv ) )
+            goto restart;
+
+        node = child;
+    }
+
+    STAT_INC( tree, get_visits );
+    i = key_search( node->key, _olc_nkeys( tree, node ), key );
+    data = i >= 0 ? ((leaf_t *)node)->data[i] : DATA_NOT_EXIST;
+
+    if( !_olc_validate( &node->version, v ) )
+        goto restart;
+
+    return data;
+}
+
+/*
+ * bptPut with lock coupling. Full nodes are still split on the way
+ * down; the split locks only the full child and its parent, which
+ * cannot be full itself, then restarts. The insertion locks only the
+ * target leaf.
+ *
+ * Other modes first descend without splitting and look for the key in
+ * the leaf. Only a new key that finds the leaf full restarts with
+ * splitting. Returns the value the key had, as _upsert.
+ */
+static int
+_olc_put( bpt_t *tree, int key, int data, int mode )
+{
+    int i, old;
+    unsigned long rv, v, cv;
+    node_t *node, *child;
+    nonleaf_t *s;
+    int split = mode == PUT_ALWAYS;
+
+restart:
+    if( !_olc_read_lock( &tree->root_version, &rv ) )
+        goto restart;
+
+    node = tree->root;
+
+    if( !node ){
+        if( mode == PUT_REPLACE ){
+            if( !_olc_validate( &tree->root_version, rv ) )
+                goto restart;
+            return DATA_NOT_EXIST;
+        }
+        if( !_olc_upgrade( &tree->root_version, rv ) )
+            goto restart;
+        tree->root = &leaf_new( tree )->node;
+        _olc_unlock( &tree->root_version );
+        goto restart;
+    }
+
+    if( !_olc_read_lock( &node->version, &v ) || !_olc_validate( &tree->root_version, rv ) )
+        goto restart;
+
+    if( split && _node_full( tree, node ) ){
+        if( !_olc_upgrade( &tree->root_version, rv ) )
+            goto restart;
+        if( !_olc_upgrade( &node->version, v ) ){
+            _olc_unlock( &tree->root_version );
+            goto restart;
+        }
+
+        s = non_leaf_new( tree );
+        s->children[0] = node;
+        _split_child( tree, &s->node, 0 );
+        tree->root = &s->node;
+
+        _olc_unlock( &node->version );
+        _olc_unlock( &tree->root_version );
+        goto restart;
+    }
+
+    while( node->type == BPLUS_TREE_NON_LEAF ){
+        STAT_INC( tree, put_visits );
+        i = _olc_child_index( tree, node, key );
+        child = ((nonleaf_t *)node)->children[i];
+
+        if( !_olc_validate( &node->version, v ) )
+            goto restart;
+        if( !_olc_read_lock( &child->version, &cv ) )
+            goto restart;
+
+        if( split && _node_full( tree, child ) ){
+            if( !_olc_upgrade( &node->version, v ) )
+                goto restart;
+            if( !_olc_upgrade( &child->version, cv ) ){
+                _olc_unlock( &node->version );
+                goto restart;
+            }
+
+            _split_child( tree, node, i );
+
+            _olc_unlock( &child->version );
+            _olc_unlock( &node->version );
+            goto restart;
+        }
+
+        if( !_olc_validate( &node->version, v ) )
+            goto restart;
+
+        node = child;
+        v = cv;
+    }
+
+    STAT_INC( tree, put_visits );
+    if( !_olc_upgrade( &node->version, v ) )
+        goto restart;
+
+    if( mode != PUT_ALWAYS ){
+        i = key_search( node->key, node->n, key );
+        if( i >= 0 ){
+            old = ((leaf_t *)node)->data[i];
+            if( mode != PUT_IF_ABSENT )
+                ((leaf_t *)node)->data[i] = data;
+            _olc_unlock( &node->version );
+            return old;
+        }
+        if( mode == PUT_REPLACE ){
+            _olc_unlock( &node->version );
+            return DATA_NOT_EXIST;
+        }
+        if( _node_full( tree, node ) ){
+            _olc_unlock( &node->version );
+            split = 1;
+            goto restart;
+        }
+    }
+
+    _insert_nonfull( tree, node, key, data );
+
+    _olc_unlock( &node->version );
+
+    return DATA_NOT_EXIST;
+}
+
+/*
+ * _pre_descend_child under locks: parent, the minimal child and its
+ * siblings are write locked, plus the root pointer when parent is the
+ * root and may be collapsed. Returns 0 if any lock could not be taken,
+ * in which case nothing was changed.
+ */
+static int
+_olc_rebalance( bpt_t *tree, node_t *parent, unsigned long v, int idx, node_t *child, unsigned long cv )
+{
+    int j, k, nlocked = 0;
+    int is_root = 0;
+    node_t *locked[3];
+    nonleaf_t *nln = (nonleaf_t *)parent;
+
+    if( !_olc_upgrade( &parent->version, v ) )
+        return 0;
+
+    if( parent == tree->root ){
+        if( !_olc_write_lock( &tree->root_version ) ){
+            _olc_unlock( &parent->version );
+            return 0;
+        }
+        is_root = 1;
+    }
+
+    if( !_olc_upgrade( &child->version, cv ) )
+        goto fail;
+    locked[nlocked++] = child;
+
+    if( idx > 0 ){
+        if( !_olc_write_lock( &nln->children[idx-1]->version ) )
+            goto fail;
+        locked[nlocked++] = nln->children[idx-1];
+    }
+
+    if( idx < parent->n ){
+        if( !_olc_write_lock( &nln->children[idx+1]->version ) )
+            goto fail;
+        locked[nlocked++] = nln->children[idx+1];
+    }
+
+    child = _pre_descend_child( tree, parent, idx );
+
+    //a node merged away was already retired by _node_free; the others
+    //are found while parent is still locked and cannot lose them
+    for( j=0; j<nlocked; j++ ){
+        for( k=0; k<=parent->n; k++ )
+            if( nln->children[k] == locked[j] )
+                break;
+        if( k<=parent->n )
+            _olc_unlock( &locked[j]->version );
+    }
+
+    if( parent->n == 0 && is_root ){
+        tree->root = child;
+        _node_free( tree, &tree->non_leaf_pool, parent );
+    }
+    else
+        _olc_unlock( &parent->version );
+
+    if( is_root )
+        _olc_unlock( &tree->root_version );
+
+    return 1;
+
+fail:
+    for( j=0; j<nlocked; j++ )
+        _olc_unlock( &locked[j]->version );
+    if( is_root )
+        _olc_unlock( &tree->root_version );
+    _olc_unlock( &parent->version );
+
+    return 0;
+}
+
+/*
+ * bptRemove with lock coupling. A minimal child is rebalanced with its
+ * parent and siblings locked before the descent restarts; a missing
+ * key is reported once the leaf is reached. In relaxed mode only the
+ * leaf is locked, unless removing the key would empty it: that case
+ * restarts as an ordinary, rebalancing deletion.
+ */
+static void
+_olc_remove( bpt_t *tree, int key )
+{
+    int i, relaxed = tree->relaxed;
+    unsigned long rv, v, cv;
+    node_t *node, *child;
+
+restart:
+    if( !_olc_read_lock( &tree->root_version, &rv ) )
+        goto restart;
+
+    node = tree->root;
+    if( !node ){
+        if( !_olc_validate( &tree->root_version, rv ) )
+            goto restart;
+        printf("Empty tree! No deletion\n");
+        return;
+    }
+
+    if( !_olc_read_lock( &node->version, &v ) || !_olc_validate( &tree->root_version, rv ) )
+        goto restart;
+
+    while( node->type == BPLUS_TREE_NON_LEAF ){
+        STAT_INC( tree, remove_visits );
+        i = _olc_child_index( tree, node, key );
+        child = ((nonleaf_t *)node)->children[i];
+
+        if( !_olc_validate( &node->version, v ) )
+            goto restart;
+        if( !_olc_read_lock( &child->version, &cv ) )
+            goto restart;
+
+        if( !relaxed && child->n <= _node_b( tree, child )-1 ){
+            _olc_rebalance( tree, node, v, i, child, cv );
+            goto restart;
+        }
 
-            nln_child = (nonleaf_t *)child;
-            nln_rsibling = (nonleaf_t *)rsibling;
-            nln_child->children[child->n] = nln_rsibling->children[0];
-            
-            _move_key( successor_key, rsibling, parent, 1, 0 );
+        if( !_olc_validate( &node->version, v ) )
+            goto restart;
+
+        node = child;
+        v = cv;
+    }
+
+    STAT_INC( tree, remove_visits );
+    if( !_olc_upgrade( &node->version, v ) )
+        goto restart;
+
+    i = key_search( node->key, node->n, key );
+
+    if( i < 0 ){
+        _olc_unlock( &node->version );
+        printf(" The key %d does not exist in the tree\n", key );
+        return;
+    }
+
+    if( relaxed && node->n == 1 && node != tree->root ){
+        _olc_unlock( &node->version );
+        relaxed = 0;
+        goto restart;
+    }
+
+    if( node->n == 1 && node == tree->root ){
+        if( !_olc_write_lock( &tree->root_version ) ){
+            _olc_unlock( &node->version );
+            goto restart;
         }
+        _remove_from_leaf( node, i );
+        tree->root = NULL;
+        _node_free( tree, &tree->leaf_pool, node );
+        _olc_unlock( &tree->root_version );
+        return;
+    }
+
+    _remove_from_leaf( node, i );
+
+    _olc_unlock( &node->version );
+}
+
+/* fraction of a leaf's capacity that bptCompact packs it to */
+#define COMPACT_FILL (0.9)
+
+/*
+ * Repack the leaves under parent to COMPACT_FILL of their capacity,
+ * moving keys left across siblings and freeing the leaves emptied at
+ * the right end. The separators in parent are recomputed; the range
+ * parent covers, and with it every separator above, is unchanged.
+ *
+ * parent keeps at least two children but may drop below the minimum
+ * fanout of a non-leaf. Deletions tolerate that: _pre_descend_child
+ * borrows into or merges such a node before descending into it.
+ * Returns the number of leaves freed.
+ */
+static int
+_compact_leaves( bpt_t *tree, node_t *parent )
+{
+    int i, j, k, cnt, nnodes, total = 0;
+    int t = tree->b_leaf;
+    int m = parent->n + 1;
+    int *keys, *data;
+    nonleaf_t *nln = (nonleaf_t *)parent;
+    leaf_t *ln, *next;
+
+    for( i=0; i<m; i++ )
+        total += nln->children[i]->n;
+
+    nnodes = _bulk_nodes( total, _bulk_per( COMPACT_FILL, t, 2*t-1 ), t-1 );
+    if( nnodes < 2 )
+        nnodes = 2;
+    if( nnodes >= m )
+        return 0;
+
+    keys = (int *)malloc( total * sizeof(int) );
+    data = (int *)malloc( total * sizeof(int) );
+    assert( keys && data );
 
+    for( i=0, k=0; i<m; i++ ){
+        ln = (leaf_t *)nln->children[i];
+        for( j=0; j<ln->node.n; j++, k++ ){
+            keys[k] = ln->node.key[j];
+            data[k] = ln->data[j];
+        }
     }
-    else if( lsibling && (lsibling->n == t-1) ){
-        assert(idx>0);
-        
-        if( child->type == BPLUS_TREE_NON_LEAF ){
-            parent_key = parent->key[idx-1];
-            if( parent_key != lsibling->key[lsibling->n-1] )
-                _move_key( parent_key, parent, lsibling, 1, 0 );//move 1-level down
+
+    next = ((leaf_t *)nln->children[m-1])->next;
+
+    for( i=0, k=0; i<nnodes; i++ ){
+        ln = (leaf_t *)nln->children[i];
+        cnt = total/nnodes + ( i < total%nnodes );
+
+        for( j=0; j<cnt; j++, k++ ){
+            ln->node.key[j] = keys[k];
+            ln->data[j] = data[k];
         }
-        else
-            _node_key_shift_left( parent, idx-1, 1 );
+        ln->node.n = cnt;
 
-        _merge_node( lsibling, child );
-        nln_parent->children[idx-1] = lsibling;
-        
-        child = lsibling;
+        if( i < nnodes-1 )
+            parent->key[i] = keys[k-1];
     }
-    else if( rsibling && (rsibling->n == t-1) ){
-        
-        if( child->type == BPLUS_TREE_NON_LEAF ){
-            parent_key = parent->key[idx];
-            if( parent_key != child->key[child->n-1] )
-                _move_key( parent_key, parent, child, 1, 0 );//move 1-level down
+    ln->next = next;
+
+    for( i=nnodes; i<m; i++ ){
+        ln = (leaf_t *)nln->children[i];
+        leaf_destroy( tree, &ln );
+    }
+    parent->n = nnodes-1;
+
+    free( keys );
+    free( data );
+
+    return m - nnodes;
+}
+
+/*
+ * Find the parent of the leaf that holds key, or NULL if the root is
+ * a leaf. In concurrent mode the parent and all its children are
+ * returned write locked; any lock that cannot be taken restarts.
+ */
+static node_t *
+_leaf_parent( bpt_t *tree, int key )
+{
+    int i;
+    unsigned long rv, v, cv;
+    node_t *node, *child;
+
+    if( !tree->concurrent ){
+        node = tree->root;
+        if( !node || node->type == BPLUS_TREE_LEAF )
+            return NULL;
+        while( ((nonleaf_t *)node)->children[0]->type == BPLUS_TREE_NON_LEAF ){
+            i = key_search( node->key, node->n, key );
+            node = ((nonleaf_t *)node)->children[ i < 0 ? -i - 1 : i ];
         }
-        else
-            _node_key_shift_left( parent, idx, 1 );
+        return node;
+    }
 
-        _merge_node( child, rsibling );
-        nln_parent->children[idx] = child;
+restart:
+    if( !_olc_read_lock( &tree->root_version, &rv ) )
+        goto restart;
+
+    node = tree->root;
+    if( !node || !_olc_read_lock( &node->version, &v ) || node->type == BPLUS_TREE_LEAF ){
+        if( !_olc_validate( &tree->root_version, rv ) )
+            goto restart;
+        if( node && node->type == BPLUS_TREE_NON_LEAF )
+            goto restart;
+        return NULL;
     }
-    else
-        assert(0);
-    
-    return child;
+    if( !_olc_validate( &tree->root_version, rv ) )
+        goto restart;
+
+    while( 1 ){
+        child = ((nonleaf_t *)node)->children[ _olc_child_index( tree, node, key ) ];
+        if( !_olc_validate( &node->version, v ) )
+            goto restart;
+        if( child->type == BPLUS_TREE_LEAF )
+            break;
+        if( !_olc_read_lock( &child->version, &cv ) || !_olc_validate( &node->version, v ) )
+            goto restart;
+        node = child;
+        v = cv;
+    }
+
+    if( !_olc_upgrade( &node->version, v ) )
+        goto restart;
+
+    for( i=0; i<=node->n; i++ ){
+        if( !_olc_write_lock( &((nonleaf_t *)node)->children[i]->version ) ){
+            while( i-- > 0 )
+                _olc_unlock( &((nonleaf_t *)node)->children[i]->version );
+            _olc_unlock( &node->version );
+            goto restart;
+        }
+    }
+
+    return node;
 }
 
+/*
+ * The smallest key in leaf, or fallback if leaf is NULL or, in
+ * concurrent mode, is being changed. Only a key repeated across two
+ * groups of leaves makes it not exceed the keys before it.
+ */
+static int
+_leaf_first_key( bpt_t *tree, leaf_t *leaf, int fallback )
+{
+    int key;
+    unsigned long v;
 
-static void
-_descend( bpt_t *tree, node_t *node, int key )
+    if( !leaf )
+        return fallback;
+
+    if( !tree->concurrent )
+        return leaf->node.key[0];
+
+    if( !_olc_read_lock( &leaf->node.version, &v ) )
+        return fallback;
+    key = leaf->node.key[0];
+
+    return _olc_validate( &leaf->node.version, v ) ? key : fallback;
+}
+
+/*
+ * Repack under-filled leaves, a group of siblings at a time, visiting
+ * about budget leaves per call. Calls resume where the previous one
+ * stopped and wrap around after the last leaf, so calling it
+ * repeatedly between requests compacts the whole tree over time.
+ * Safe alongside concurrent bptGet, bptPut and bptRemove, but only one
+ * thread may compact at a time. Returns the number of leaves freed.
+ */
+int
+bptCompact( bpt_t *tree, int budget )
 {
-    int i;
-    nonleaf_t *nln;
-    leaf_t *ln;
-    node_t *child;
+    int i, last_key, next_key, done, visited = 0, freed = 0;
+    node_t *parent;
+    leaf_t *last;
 
-    i = key_binary_search(node->key, node->n, key);
+    if( tree->snap )
+        return 0;
 
-    if( i>= 0 ){ //key found in node 
-        if( node->type == BPLUS_TREE_LEAF ){
-            _remove_from_leaf( node, i );
-            if( node->n==0 && node==tree->root ){
-                ln = (leaf_t *)node;
-                leaf_destroy(&ln);
-                tree->root = NULL;
-            }
-            return;
+    _thaw( tree );
+
+    if( tree->concurrent )
+        epochEnter( &tree->epoch );
+
+    while( visited < budget ){
+        parent = _leaf_parent( tree, tree->compact_key );
+        if( !parent )
+            break;
+
+        visited += parent->n + 1;
+        freed += _compact_leaves( tree, parent );
+
+        //separators above may be looser than the keys left below them,
+        //so the next group is found by the first key of the next leaf
+        last = (leaf_t *)((nonleaf_t *)parent)->children[parent->n];
+        last_key = last->node.key[last->node.n-1];
+        next_key = _leaf_first_key( tree, last->next, last_key < INT_MAX ? last_key + 1 : last_key );
+        done = !last->next || next_key <= last_key;
+
+        if( tree->concurrent ){
+            for( i=0; i<=parent->n; i++ )
+                _olc_unlock( &((nonleaf_t *)parent)->children[i]->version );
+            _olc_unlock( &parent->version );
+        }
+
+        if( done ){
+            tree->compact_key = INT_MIN;
+            break;
         }
+        tree->compact_key = next_key;
     }
-        
-    //key not found in the node
-    if( node->type == BPLUS_TREE_LEAF ){
-        printf(" The key %d does not exist in the tree\n", key );
-        return;
+
+    if( tree->concurrent )
+        epochExit( &tree->epoch );
+
+    return freed;
+}
+
+/*
+ * Switch the tree to optimistic lock coupling so that bptGet, bptPut
+ * and bptRemove can be called from several threads at once. Must be
+ * called while no other thread uses the tree. Scans, batched and bulk
+ * operations still need the caller to exclude writers. Nodes unlinked
+ * meanwhile return to the pools through epoch-based reclamation, and
+ * switching back off reclaims whatever is still pending. A packed tree
+ * is unpacked first.
+ */
+void
+bptSetConcurrent( bpt_t *tree, int on )
+{
+    if( !on )
+        epochFlush( &tree->epoch );
+    else
+        _unpack( tree );
+
+    _thaw( tree );
+    tree->concurrent = on;
+    tree->last = NULL;
+}
+
+/*
+ * Index the leaves of a tree that is about to serve only reads with a
+ * separator array in Eytzinger order (eytz.h). bptGet, bptGetBatch,
+ * bptScan and the cursor then find their leaf by arithmetic on that
+ * array instead of chasing child pointers level by level. The
+ * non-leaves are kept but left cold, so the next modification reverts
+ * the tree to mutable mode just by dropping the index. A learned model
+ * is trained over the same separators if bptSetLearned asked for one.
+ * Returns 0 on success, -1 for a snapshot, a packed tree or a tree in
+ * concurrent mode.
+ */
+int
+bptFreeze( bpt_t *tree )
+{
+    int m = 0, i;
+    int *seps;
+    void **leaves;
+    node_t *node;
+    leaf_t *leaf;
+
+    if( tree->snap || tree->concurrent ){
+        printf("Only a private tree can be frozen\n");
+        return -1;
     }
-    
-    assert( node->type == BPLUS_TREE_NON_LEAF );
 
-    nln = (nonleaf_t *)node;
-    
-    if (i < 0) 
-        i = -i - 1;
+    _thaw( tree );
 
-    child = _pre_descend_child( tree, node, i );
-    
-    _descend( tree, child, key );
-    
-    if( node->n==0 && node==tree->root ){
-        non_leaf_destroy(&nln);
-        tree->root = child;
+    if( !tree->root )
+        return 0;
+
+    node = tree->root;
+    while( node->type == BPLUS_TREE_NON_LEAF )
+        node = ((nonleaf_t *)node)->children[0];
+    for( leaf = (leaf_t *)node; leaf; leaf = leaf->next )
+        m++;
+
+    seps = (int *)malloc( m * sizeof(int) );
+    leaves = (void **)malloc( m * sizeof(void *) );
+    assert( seps && leaves );
+
+    //a leaf's last key separates it from the next
+    for( i = 0, leaf = (leaf_t *)node; leaf; leaf = leaf->next, i++ ){
+        leaves[i] = leaf;
+        seps[i] = leaf->node.key[leaf->node.n-1];
     }
-    
-    return;
+
+    tree->frozen = eytzBuild( seps, leaves, m );
+    if( tree->learn_eps )
+        tree->model = plmBuild( seps, leaves, m, tree->learn_eps );
+
+    free( seps );
+    free( leaves );
+
+    return 0;
+}
+
+/*
+ * Rewrite a tree that is about to serve mostly reads into packed
+ * leaves held in memory (snapshot.h): each leaf keeps its keys and
+ * data as 1- or 2-byte deltas from a base where their range allows,
+ * searched with the SIMD delta rank, and is filled to the bytes of a
+ * full plain leaf, so a dense tree holds two to four times the pairs
+ * per leaf and the mutable nodes are released. bptGet, bptGetBatch,
+ * bptScan and the cursor read the packed leaves in place; the first
+ * modification rebuilds mutable leaves from them, as does switching
+ * concurrent mode on. Returns 0 on success, -1 for a snapshot or a
+ * tree in concurrent mode.
+ */
+int
+bptPack( bpt_t *tree )
+{
+    snapshot_t *s;
+
+    if( tree->snap || tree->concurrent ){
+        printf("Only a private tree can be packed\n");
+        return -1;
+    }
+
+    _thaw( tree );
+    s = snapBuild( tree, 1 );
+
+    slabDestroy( &tree->leaf_pool );
+    slabDestroy( &tree->non_leaf_pool );
+    slabInit( &tree->leaf_pool, _leaf_size(2*tree->b_leaf-1), NODES_PER_SLAB );
+    slabInit( &tree->non_leaf_pool, _non_leaf_size(2*tree->b_inner-1), NODES_PER_SLAB );
+    tree->root = NULL;
+    tree->last = NULL;
+    tree->snap = s;
+    tree->packed = 1;
+
+    return 0;
+}
+
+/* rebuild the mutable leaves of a packed tree before it is modified */
+static void
+_unpack( bpt_t *tree )
+{
+    int n, got = 0;
+    int *keys, *data;
+    bpt_cursor_t cur;
+    snapshot_t *s = tree->snap;
+
+    if( !tree->packed )
+        return;
+
+    n = (int)((const snap_header_t *)s->base)->nkeys;
+    keys = (int *)malloc( ( n+1 ) * sizeof(int) );
+    data = (int *)malloc( ( n+1 ) * sizeof(int) );
+    assert( keys && data );
+
+    bptCursorSeek( tree, &cur, INT_MIN, INT_MAX );
+    while( got < n )
+        got += bptCursorNext( &cur, keys + got, data + got, n - got );
+
+    tree->snap = NULL;
+    tree->packed = 0;
+    snapClose( s );
+
+    if( n > 0 )
+        _bulk_load( tree, keys, data, n, UNPACK_FILL, 0 );
+
+    free( keys );
+    free( data );
 }
 
+/*
+ * Ask for a learned routing layer (plm.h) with error bound eps, or
+ * drop it with eps 0. The model is trained from the leaf chain by the
+ * next bptFreeze or bptBulkLoad and lives until the tree is modified.
+ * Lookups go to the leaf it predicts once the leaf is confirmed and
+ * fall back to the frozen index or the root on a miss; bptStats
+ * reports the model's size, error and hit rate.
+ */
 void
-bptRemove( bpt_t *tree, int key ){
-    
-    if( !tree->root )
-        printf("Empty tree! No deletion\n");
-    else
-        return _descend( tree, tree->root, key );
+bptSetLearned( bpt_t *tree, int eps )
+{
+    assert( eps >= 0 );
+
+    tree->learn_eps = eps;
+    if( !eps && tree->model ){
+        plmFree( tree->model );
+        tree->model = NULL;
+    }
 }
 
-bpt_t *
-bptInit( int b )
+/*
+ * Switch append mode on or off. Keys above every key already stored
+ * then skip the descent and go straight to the rightmost leaf, and the
+ * right spine is split unevenly: leaves fill completely and non-leaves
+ * to about 90%. Other keys are inserted as usual. Concurrent mode does
+ * not use it.
+ */
+void
+bptSetAppend( bpt_t *tree, int on )
+{
+    tree->append = on;
+    tree->last = NULL;
+}
+
+/*
+ * Switch bptRemove between rebalancing on the way down (the default)
+ * and relaxed deletion, which touches only the leaf holding the key and
+ * frees nodes once they are empty, so a missing key leaves the tree as
+ * it was. Under-filled leaves left behind are repacked by bptCompact.
+ */
+void
+bptSetRelaxed( bpt_t *tree, int on )
+{
+    tree->relaxed = on;
+}
+
+/*
+ * Create a tree whose leaves hold up to 2*b_leaf-1 keys and whose
+ * non-leaves hold up to 2*b_inner-1 keys.
+ */
+static bpt_t *
+_tree_new( int b_leaf, int b_inner )
 {
     bpt_t *t;
 
-    assert( b>2 );
+    assert( b_leaf>2 && b_inner>2 );
+
+    pthread_once( &key_search_once, _key_search_init );
 
     t = ( bpt_t * ) malloc ( sizeof(bpt_t) );
     
     if( t ){
-        t->b_factor = b;
+        t->b_leaf = b_leaf;
+        t->b_inner = b_inner;
         t->root = NULL;
+        t->concurrent = 0;
+        t->root_version = 0;
+        t->snap = NULL;
+        t->wal = NULL;
+        t->ckpt_path = NULL;
+        t->ckpt_bytes = 0;
+        memset( &t->counters, 0, sizeof(t->counters) );
+        t->compact_key = INT_MIN;
+        t->relaxed = 0;
+        t->append = 0;
+        t->last = NULL;
+        t->frozen = NULL;
+        t->learn_eps = 0;
+        t->model = NULL;
+        t->packed = 0;
+        pthread_mutex_init( &t->pool_lock, NULL );
+        epochInit( &t->epoch, _node_reclaim, t );
+        slabInit( &t->leaf_pool, _leaf_size(2*b_leaf-1), NODES_PER_SLAB );
+        slabInit( &t->non_leaf_pool, _non_leaf_size(2*b_inner-1), NODES_PER_SLAB );
+    }
+
+    return t;
+}
+
+bpt_t *
+bptInit( int b )
+{
+    return _tree_new( b, b );
+}
+
+/*
+ * Create a tree with node capacities derived from node sizes in bytes,
+ * e.g. a few cache lines for non-leaves and a page for leaves.
+ * Returns NULL if a node of either size cannot hold 5 keys.
+ */
+bpt_t *
+bptInitSized( int inner_bytes, int leaf_bytes )
+{
+    int b_leaf = _b_for_size( BPLUS_TREE_LEAF, leaf_bytes );
+    int b_inner = _b_for_size( BPLUS_TREE_NON_LEAF, inner_bytes );
+
+    if( b_leaf<3 || b_inner<3 )
+        return NULL;
+
+    return _tree_new( b_leaf, b_inner );
+}
+
+/*
+ * Save tree to path as a snapshot that bptSnapshotOpen can map back.
+ * The tree must not be modified meanwhile. Returns 0 on success.
+ */
+int
+bptSnapshotWrite( bpt_t *tree, const char *path )
+{
+    if( tree->snap && !tree->packed ){
+        printf("Tree is a snapshot already\n");
+        return -1;
+    }
+
+    return snapWrite( tree, path, 0 );
+}
+
+/*
+ * As bptSnapshotWrite, but with the leaves of bptPack: keys and data
+ * that span less than 2^16 within a leaf are stored as 1- or 2-byte
+ * deltas, and each leaf holds as many pairs as fit in a plain one.
+ */
+int
+bptSnapshotWritePacked( bpt_t *tree, const char *path )
+{
+    if( tree->snap && !tree->packed ){
+        printf("Tree is a snapshot already\n");
+        return -1;
     }
 
+    return snapWrite( tree, path, 1 );
+}
+
+/*
+ * Map a snapshot as a read-only tree: bptGet, bptGetBatch, bptScan and
+ * the cursor search the file in place, nothing is loaded up front.
+ * Returns NULL if path is not a snapshot.
+ */
+bpt_t *
+bptSnapshotOpen( const char *path )
+{
+    bpt_t *t;
+    snapshot_t *s = snapOpen( path );
+
+    if( !s )
+        return NULL;
+
+    t = _tree_new( ((const snap_header_t *)s->base)->b_leaf, ((const snap_header_t *)s->base)->b_inner );
+    assert( t );
+    t->snap = s;
+
     return t;
 }
 
+static void
+_wal_replay( void *ctx, int op, int key, int data )
+{
+    bpt_t *tree = (bpt_t *)ctx;
+
+    if( op == WAL_PUT )
+        _put( tree, key, data );
+    else if( op == WAL_REMOVE && tree->root )
+        _remove( tree, key );
+    else if( op == WAL_UPSERT || op == WAL_INSERT_IF_ABSENT || op == WAL_REPLACE )
+        _upsert( tree, key, data, op );
+    else if( op == WAL_REMOVE_RANGE )
+        _remove_range( tree, key, data );
+}
+
+/*
+ * Make the empty tree durable through a write-ahead log at path and a
+ * checkpoint at path.ckpt. Whatever both hold from an earlier run is
+ * recovered first: the checkpoint is bulk loaded and the log records
+ * after it are replayed. From then on every insertion and deletion is
+ * logged, and the log is checkpointed and emptied whenever it grows
+ * past ckpt_bytes (never if 0). Call before the tree is shared.
+ * Returns 0 on success.
+ */
+int
+bptWalOpen( bpt_t *tree, const char *path, long long ckpt_bytes )
+{
+    unsigned long long lsn;
+    size_t len = strlen( path );
+
+    if( tree->root || tree->snap || tree->wal ){
+        printf("Tree is not empty! No log\n");
+        return -1;
+    }
+
+    tree->ckpt_path = (char *)malloc( len + 6 );
+    assert( tree->ckpt_path );
+    memcpy( tree->ckpt_path, path, len );
+    memcpy( tree->ckpt_path + len, ".ckpt", 6 );
+
+    if( walCheckpointLoad( tree->ckpt_path, tree, &lsn ) == 0 )
+        tree->wal = walOpen( path, lsn, _wal_replay, tree );
+
+    if( !tree->wal ){
+        printf("Cannot open log %s\n", path);
+        free( tree->ckpt_path );
+        tree->ckpt_path = NULL;
+        return -1;
+    }
+
+    tree->ckpt_bytes = ckpt_bytes;
+
+    return 0;
+}
+
+/*
+ * Write the whole tree to the checkpoint and empty the log. Writers
+ * are held off meanwhile. Returns 0 on success.
+ */
+int
+bptCheckpoint( bpt_t *tree )
+{
+    if( !tree->wal )
+        return -1;
+
+    return _checkpoint( tree, 0 );
+}
+
+/*
+ * Sync the log and stop logging; no other thread may use the tree.
+ * Returns -1 if some logged operation could not be made durable.
+ */
+int
+bptWalClose( bpt_t *tree )
+{
+    int r = walClose( tree->wal );
+
+    tree->wal = NULL;
+    free( tree->ckpt_path );
+    tree->ckpt_path = NULL;
+
+    return r;
+}
+
+/*
+ * All nodes live in the tree's slab pools, so the whole tree is
+ * released at once without walking it.
+ */
 void
 bptDestroy( bpt_t *tree ){
 
-    if( tree )
+    if( tree ){
+        bptWalClose( tree );
+        snapClose( tree->snap );
+        eytzFree( tree->frozen );
+        plmFree( tree->model );
+        epochDestroy( &tree->epoch );
+        slabDestroy( &tree->leaf_pool );
+        slabDestroy( &tree->non_leaf_pool );
+        pthread_mutex_destroy( &tree->pool_lock );
         free(tree);
+    }
 }
 
 #ifdef DEBUG
@@ -725,7 +3604,7 @@ _dump( bpt_t *tree, node_t *node ){
     else
         assert(0);
 
-    printf("B Factor = %d\n", tree->b_factor );
+    printf("B Factor = %d\n", _node_b( tree, node ) );
     printf("# keys = %d\n", node->n );
     
     for( i=0; i<node->n; i++){
@@ -36,6 +36,15 @@
 #ifndef _HEADER_BPLUSTREE_
 #define _HEADER_BPLUSTREE_
 
+#include <pthread.h>
+
+#include "slab.h"
+#include "epoch.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "eytz.h"
+#include "plm.h"
+
 #define MAX_LEVEL (20)
 #define KEY_NOT_FOUND (-1)
 #define DATA_NOT_EXIST (-1)
@@ -54,6 +63,7 @@ typedef struct node {
     int *key;
     int type;
     int n;
+    unsigned long version;
 }node_t;
 
 typedef struct non_leaf {
@@ -67,17 +77,105 @@ typedef struct leaf {
     int *data;
 }leaf_t;
 
+/*
+ * Shape of a tree as reported by bptStats. nodes[l] counts the nodes
+ * on level l, the root being level 0. Leaf fill is keys over capacity.
+ * The operation counters are only maintained when the library is
+ * built with BPT_STATS defined and stay 0 otherwise. The model fields
+ * describe the learned routing layer, if one is trained (bptSetLearned).
+ */
+typedef struct stats {
+    int height;
+    long nodes[MAX_LEVEL];
+    long keys;
+    double leaf_fill;
+    double min_leaf_fill;
+    size_t bytes;
+    unsigned long splits;
+    unsigned long merges;
+    unsigned long borrows_left;
+    unsigned long borrows_right;
+    unsigned long gets;
+    unsigned long puts;
+    unsigned long removes;
+    unsigned long get_visits;
+    unsigned long put_visits;
+    unsigned long remove_visits;
+    unsigned long model_hits;
+    unsigned long model_misses;
+    int model_segments;
+    int model_max_err;
+    double model_avg_err;
+}bpt_stats_t;
+
 struct tree {
-    int b_factor;
+    int b_leaf;
+    int b_inner;
     struct node *root;
+    slab_t leaf_pool;
+    slab_t non_leaf_pool;
+    int concurrent;
+    unsigned long root_version;
+    pthread_mutex_t pool_lock;
+    epoch_t epoch;
+    snapshot_t *snap;
+    wal_t *wal;
+    char *ckpt_path;
+    long long ckpt_bytes;
+    bpt_stats_t counters;
+    int compact_key;
+    int relaxed;
+    int append;
+    leaf_t *last;
+    eytz_t *frozen;
+    int learn_eps;
+    plm_t *model;
+    int packed;
 };
 
 typedef struct tree bpt_t;
 
+typedef struct cursor {
+    leaf_t *leaf;
+    const snap_node_t *sleaf;
+    int pos;
+    int hi;
+}bpt_cursor_t;
+
+/* return non-zero to stop the scan */
+typedef int (*bpt_scan_cb)( int key, int data, void *arg );
+
 bpt_t * bptInit( int );
+bpt_t * bptInitSized( int, int );
+void bptTune( int, int *, int * );
 void bptDestroy( bpt_t * );
+void bptSetConcurrent( bpt_t *, int );
+void bptSetRelaxed( bpt_t *, int );
+void bptSetAppend( bpt_t *, int );
+void bptSetLearned( bpt_t *, int );
+int bptFreeze( bpt_t * );
+int bptPack( bpt_t * );
 int bptGet( bpt_t *, int );
-void bptPut( bpt_t *, int, int );
-void bptRemove( bpt_t *, int );
+void bptGetBatch( bpt_t *, int *, int *, int );
+int bptPut( bpt_t *, int, int );
+int bptPutBatch( bpt_t *, int *, int *, int );
+int bptUpsert( bpt_t *, int, int, int * );
+int bptInsertIfAbsent( bpt_t *, int, int, int * );
+int bptReplace( bpt_t *, int, int, int * );
+int bptBulkLoad( bpt_t *, int *, int *, int, double );
+int bptBuildParallel( bpt_t *, int *, int *, int, int );
+int bptRemove( bpt_t *, int );
+int bptRemoveRange( bpt_t *, int, int );
 void bptDump( bpt_t * );
+void bptStats( bpt_t *, bpt_stats_t * );
+int bptCompact( bpt_t *, int );
+int bptScan( bpt_t *, int, int, bpt_scan_cb, void * );
+void bptCursorSeek( bpt_t *, bpt_cursor_t *, int, int );
+int bptCursorNext( bpt_cursor_t *, int *, int *, int );
+int bptSnapshotWrite( bpt_t *, const char * );
+int bptSnapshotWritePacked( bpt_t *, const char * );
+bpt_t * bptSnapshotOpen( const char * );
+int bptWalOpen( bpt_t *, const char *, long long );
+int bptCheckpoint( bpt_t * );
+int bptWalClose( bpt_t * );
 #endif
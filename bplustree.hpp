@@ -0,0 +1,547 @@
+/*  bplustree.hpp
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+#ifndef _HEADER_BPLUSTREE_HPP_
+#define _HEADER_BPLUSTREE_HPP_
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <utility>
+
+/*
+ * Header-only B+ tree over arbitrary key and value types, built on the
+ * same top-down algorithms as bplustree.c: preemptive splits on the way
+ * down for insertion, and one-pass deletion that borrows from or merges
+ * with a sibling before descending into a minimal child.
+ *
+ * LeafCap and InnerCap are the maximum number of keys in a leaf and a
+ * non-leaf node. They must be odd (2*t-1 for a branching factor t) and
+ * are compile-time constants, so node loops have fixed bounds. Keys must
+ * be default constructible and copyable. Values only need to be movable;
+ * they are moved into the tree and moved between nodes, never copied.
+ */
+template < typename Key, typename Value, int LeafCap = 63, int InnerCap = 31,
+           typename Compare = std::less<Key> >
+class BPlusTree {
+    static_assert( LeafCap >= 5 && LeafCap % 2 == 1, "LeafCap must be odd and >= 5" );
+    static_assert( InnerCap >= 5 && InnerCap % 2 == 1, "InnerCap must be odd and >= 5" );
+
+    static constexpr int leaf_b = ( LeafCap + 1 ) / 2;
+    static constexpr int inner_b = ( InnerCap + 1 ) / 2;
+
+    struct node {
+        int n;
+        bool is_leaf;
+    };
+
+    struct leaf : node {
+        Key key[LeafCap];
+        alignas(Value) unsigned char data[LeafCap * sizeof(Value)];
+        leaf *next;
+
+        Value *val( int i ) { return reinterpret_cast<Value *>( data ) + i; }
+    };
+
+    struct non_leaf : node {
+        Key key[InnerCap];
+        node *children[InnerCap+1];
+    };
+
+public:
+    BPlusTree() : root_( nullptr ), size_( 0 ) {}
+
+    ~BPlusTree() { clear(); }
+
+    BPlusTree( const BPlusTree & ) = delete;
+    BPlusTree &operator=( const BPlusTree & ) = delete;
+
+    BPlusTree( BPlusTree &&o ) : root_( o.root_ ), size_( o.size_ )
+    {
+        o.root_ = nullptr;
+        o.size_ = 0;
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    void clear()
+    {
+        _destroy( root_ );
+        root_ = nullptr;
+        size_ = 0;
+    }
+
+    /* Pointer to the value stored under key, nullptr if there is none. */
+    Value *get( const Key &key )
+    {
+        int i;
+        node *n = root_;
+
+        if( !n )
+            return nullptr;
+
+        while( !n->is_leaf ){
+            non_leaf *nln = static_cast<non_leaf *>( n );
+            n = nln->children[ _lower_bound( nln->key, n->n, key ) ];
+        }
+
+        leaf *ln = static_cast<leaf *>( n );
+        i = _lower_bound( ln->key, n->n, key );
+
+        if( i < n->n && !comp_( key, ln->key[i] ) )
+            return ln->val( i );
+
+        return nullptr;
+    }
+
+    /* Insert key, moving value into the tree. Duplicates are kept, as with bptPut. */
+    template < typename V >
+    void put( const Key &key, V &&value )
+    {
+        node *n;
+
+        if( !root_ )
+            root_ = _leaf_new();
+
+        n = root_;
+
+        if( _full( n ) ){
+            non_leaf *s = _non_leaf_new();
+            s->children[0] = n;
+            root_ = s;
+            _split_child( s, 0 );
+            n = s;
+        }
+
+        _insert_nonfull( n, key, std::forward<V>( value ) );
+        size_++;
+    }
+
+    /* Remove one entry stored under key. Returns false if there is none. */
+    bool remove( const Key &key )
+    {
+        if( !root_ )
+            return false;
+
+        if( !_descend( root_, key ) )
+            return false;
+
+        size_--;
+        return true;
+    }
+
+    /*
+     * Call f(key, value) on every entry with lo <= key <= hi in key
+     * order; f returns true to stop. Returns the number of entries visited.
+     */
+    template < typename F >
+    size_t scan( const Key &lo, const Key &hi, F f )
+    {
+        int i;
+        size_t cnt = 0;
+        node *n = root_;
+
+        if( !n )
+            return 0;
+
+        while( !n->is_leaf ){
+            non_leaf *nln = static_cast<non_leaf *>( n );
+            n = nln->children[ _lower_bound( nln->key, n->n, lo ) ];
+        }
+
+        leaf *ln = static_cast<leaf *>( n );
+
+        for( i = _lower_bound( ln->key, n->n, lo ); ln; ln = ln->next, i = 0 )
+            for( ; i < ln->n; i++ ){
+                if( comp_( hi, ln->key[i] ) )
+                    return cnt;
+                cnt++;
+                if( f( static_cast<const Key &>( ln->key[i] ), *ln->val( i ) ) )
+                    return cnt;
+            }
+
+        return cnt;
+    }
+
+private:
+    node *root_;
+    size_t size_;
+    Compare comp_;
+
+    static leaf *_leaf_new()
+    {
+        leaf *l = new leaf;
+        l->n = 0;
+        l->is_leaf = true;
+        l->next = nullptr;
+        return l;
+    }
+
+    static non_leaf *_non_leaf_new()
+    {
+        non_leaf *nl = new non_leaf;
+        nl->n = 0;
+        nl->is_leaf = false;
+        return nl;
+    }
+
+    static void _leaf_delete( leaf *l )
+    {
+        for( int i = 0; i < l->n; i++ )
+            l->val( i )->~Value();
+        delete l;
+    }
+
+    static void _destroy( node *n )
+    {
+        if( !n )
+            return;
+
+        if( n->is_leaf ){
+            _leaf_delete( static_cast<leaf *>( n ) );
+            return;
+        }
+
+        non_leaf *nl = static_cast<non_leaf *>( n );
+        for( int i = 0; i <= n->n; i++ )
+            _destroy( nl->children[i] );
+        delete nl;
+    }
+
+    static bool _full( node *n )
+    {
+        return n->n == ( n->is_leaf ? LeafCap : InnerCap );
+    }
+
+    static int _t( node *n )
+    {
+        return n->is_leaf ? leaf_b : inner_b;
+    }
+
+    /* first slot whose key is not less than key */
+    int _lower_bound( const Key *arr, int len, const Key &key ) const
+    {
+        int low = -1, high = len, mid;
+
+        while( low + 1 < high ){
+            mid = low + ( high - low ) / 2;
+            if( comp_( arr[mid], key ) )
+                low = mid;
+            else
+                high = mid;
+        }
+
+        return high;
+    }
+
+    /* move cnt values from src[spos..] into the unconstructed slots dst[dpos..] */
+    static void _move_vals( leaf *dst, int dpos, leaf *src, int spos, int cnt )
+    {
+        for( int j = 0; j < cnt; j++ ){
+            new ( dst->val( dpos+j ) ) Value( std::move( *src->val( spos+j ) ) );
+            src->val( spos+j )->~Value();
+        }
+    }
+
+    /* open slot idx in a leaf; the slot is left unconstructed */
+    static void _leaf_shift_right( leaf *l, int idx )
+    {
+        for( int j = l->n; j > idx; j-- ){
+            l->key[j] = l->key[j-1];
+            new ( l->val( j ) ) Value( std::move( *l->val( j-1 ) ) );
+            l->val( j-1 )->~Value();
+        }
+        l->n++;
+    }
+
+    /* close the unconstructed slot idx in a leaf */
+    static void _leaf_shift_left( leaf *l, int idx )
+    {
+        for( int j = idx; j < l->n-1; j++ ){
+            l->key[j] = l->key[j+1];
+            new ( l->val( j ) ) Value( std::move( *l->val( j+1 ) ) );
+            l->val( j+1 )->~Value();
+        }
+        l->n--;
+    }
+
+    /* remove key idx and child idx+ptr_off from a non-leaf */
+    static void _non_leaf_remove( non_leaf *nl, int idx, int ptr_off )
+    {
+        int j;
+
+        for( j = idx; j < nl->n-1; j++ )
+            nl->key[j] = nl->key[j+1];
+        for( j = idx+ptr_off; j < nl->n; j++ )
+            nl->children[j] = nl->children[j+1];
+        nl->n--;
+    }
+
+    void _split_child( non_leaf *parent, int i )
+    {
+        int j, t;
+        node *y = parent->children[i];
+        node *z;
+
+        t = _t( y );
+
+        if( y->is_leaf ){
+            leaf *y_ln = static_cast<leaf *>( y );
+            leaf *z_ln = _leaf_new();
+
+            for( j = 0; j < t-1; j++ )
+                z_ln->key[j] = y_ln->key[t+j];
+            _move_vals( z_ln, 0, y_ln, t, t-1 );
+
+            z_ln->n = t-1;
+            y->n = t;
+            z_ln->next = y_ln->next;
+            y_ln->next = z_ln;
+            z = z_ln;
+        }
+        else{
+            non_leaf *y_nln = static_cast<non_leaf *>( y );
+            non_leaf *z_nln = _non_leaf_new();
+
+            for( j = 0; j < t-1; j++ )
+                z_nln->key[j] = y_nln->key[t+j];
+            for( j = 0; j < t; j++ )
+                z_nln->children[j] = y_nln->children[t+j];
+
+            z_nln->n = t-1;
+            y->n = t-1;
+            z = z_nln;
+        }
+
+        for( j = parent->n+1; j > i+1; j-- )
+            parent->children[j] = parent->children[j-1];
+        parent->children[i+1] = z;
+
+        for( j = parent->n; j > i; j-- )
+            parent->key[j] = parent->key[j-1];
+        parent->key[i] = y->is_leaf ? static_cast<leaf *>( y )->key[t-1]
+                                 : static_cast<non_leaf *>( y )->key[t-1];
+        parent->n++;
+    }
+
+    template < typename V >
+    void _insert_nonfull( node *n, const Key &key, V &&value )
+    {
+        int i;
+
+        while( !n->is_leaf ){
+            non_leaf *nln = static_cast<non_leaf *>( n );
+
+            i = _lower_bound( nln->key, n->n, key );
+
+            if( _full( nln->children[i] ) ){
+                _split_child( nln, i );
+                if( comp_( nln->key[i], key ) )
+                    i++;
+            }
+
+            n = nln->children[i];
+        }
+
+        leaf *ln = static_cast<leaf *>( n );
+
+        //after any duplicates, as bptPut does
+        for( i = n->n; i >= 1 && comp_( key, ln->key[i-1] ); i-- )
+            ;
+
+        _leaf_shift_right( ln, i );
+        ln->key[i] = key;
+        new ( ln->val( i ) ) Value( std::forward<V>( value ) );
+    }
+
+    /* append the keys, children or values of right to left and free right */
+    void _merge_node( node *left, node *right )
+    {
+        int k;
+
+        if( left->is_leaf ){
+            leaf *l_ln = static_cast<leaf *>( left );
+            leaf *r_ln = static_cast<leaf *>( right );
+
+            for( k = 0; k < right->n; k++ )
+                l_ln->key[left->n+k] = r_ln->key[k];
+            _move_vals( l_ln, left->n, r_ln, 0, right->n );
+
+            left->n += right->n;
+            l_ln->next = r_ln->next;
+            r_ln->n = 0;
+            delete r_ln;
+        }
+        else{
+            non_leaf *l_nln = static_cast<non_leaf *>( left );
+            non_leaf *r_nln = static_cast<non_leaf *>( right );
+
+            for( k = 0; k < right->n; k++ ){
+                l_nln->key[left->n+k] = r_nln->key[k];
+                l_nln->children[left->n+k] = r_nln->children[k];
+            }
+            l_nln->children[left->n+right->n] = r_nln->children[right->n];
+
+            left->n += right->n;
+            delete r_nln;
+        }
+    }
+
+    /*
+     * Make sure child idx of parent has more than t-1 keys before
+     * descending into it, by borrowing from a sibling or merging with one.
+     */
+    node *_pre_descend_child( non_leaf *parent, int idx )
+    {
+        node *child = parent->children[idx];
+        node *lsibling = idx > 0 ? parent->children[idx-1] : nullptr;
+        node *rsibling = idx < parent->n ? parent->children[idx+1] : nullptr;
+        int t = _t( child );
+
+        if( child->n > t-1 )
+            return child;
+
+        if( lsibling && lsibling->n > t-1 ){
+            if( child->is_leaf ){
+                leaf *c = static_cast<leaf *>( child );
+                leaf *l = static_cast<leaf *>( lsibling );
+
+                _leaf_shift_right( c, 0 );
+                c->key[0] = l->key[l->n-1];
+                _move_vals( c, 0, l, l->n-1, 1 );
+                l->n--;
+                parent->key[idx-1] = l->key[l->n-1];
+            }
+            else{
+                non_leaf *c = static_cast<non_leaf *>( child );
+                non_leaf *l = static_cast<non_leaf *>( lsibling );
+                int j;
+
+                for( j = c->n; j > 0; j-- )
+                    c->key[j] = c->key[j-1];
+                for( j = c->n+1; j > 0; j-- )
+                    c->children[j] = c->children[j-1];
+                c->key[0] = parent->key[idx-1];
+                c->children[0] = l->children[l->n];
+                c->n++;
+
+                parent->key[idx-1] = l->key[l->n-1];
+                l->n--;
+            }
+        }
+        else if( rsibling && rsibling->n > t-1 ){
+            if( child->is_leaf ){
+                leaf *c = static_cast<leaf *>( child );
+                leaf *r = static_cast<leaf *>( rsibling );
+
+                c->key[c->n] = r->key[0];
+                _move_vals( c, c->n, r, 0, 1 );
+                c->n++;
+                _leaf_shift_left( r, 0 );
+                parent->key[idx] = c->key[c->n-1];
+            }
+            else{
+                non_leaf *c = static_cast<non_leaf *>( child );
+                non_leaf *r = static_cast<non_leaf *>( rsibling );
+
+                c->key[c->n] = parent->key[idx];
+                c->children[c->n+1] = r->children[0];
+                c->n++;
+
+                parent->key[idx] = r->key[0];
+                _non_leaf_remove( r, 0, 0 );
+            }
+        }
+        else if( lsibling ){
+            if( !child->is_leaf ){
+                non_leaf *l = static_cast<non_leaf *>( lsibling );
+                l->key[l->n++] = parent->key[idx-1];
+            }
+            _non_leaf_remove( parent, idx-1, 1 );
+            _merge_node( lsibling, child );
+            child = lsibling;
+        }
+        else{
+            assert( rsibling );
+            if( !child->is_leaf ){
+                non_leaf *c = static_cast<non_leaf *>( child );
+                c->key[c->n++] = parent->key[idx];
+            }
+            _non_leaf_remove( parent, idx, 1 );
+            _merge_node( child, rsibling );
+        }
+
+        return child;
+    }
+
+    bool _descend( node *n, const Key &key )
+    {
+        int i;
+        bool found;
+
+        if( n->is_leaf ){
+            leaf *ln = static_cast<leaf *>( n );
+
+            i = _lower_bound( ln->key, n->n, key );
+            if( i >= n->n || comp_( key, ln->key[i] ) )
+                return false;
+
+            ln->val( i )->~Value();
+            _leaf_shift_left( ln, i );
+
+            if( n->n == 0 && n == root_ ){
+                delete ln;
+                root_ = nullptr;
+            }
+            return true;
+        }
+
+        non_leaf *nln = static_cast<non_leaf *>( n );
+        node *child = _pre_descend_child( nln, _lower_bound( nln->key, n->n, key ) );
+
+        found = _descend( child, key );
+
+        if( n->n == 0 && n == root_ ){
+            delete nln;
+            root_ = child;
+        }
+
+        return found;
+    }
+};
+
+#endif
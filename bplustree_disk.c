@@ -0,0 +1,555 @@
+/*  bplustree_disk.c
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "bplustree_disk.h"
+#include "keysearch.h"
+
+/* every change to a pinned node goes through here before it is unpinned */
+#define DISK_WRITE(tree, node) pagerDirty( (tree)->pager, (node) )
+
+static inline int *
+_keys( disk_node_t *node )
+{
+    return (int *)( node + 1 );
+}
+
+static inline int *
+_data( bptd_t *tree, disk_node_t *node )
+{
+    return _keys( node ) + 2*tree->b_leaf-1;
+}
+
+static inline pgno_t *
+_children( bptd_t *tree, disk_node_t *node )
+{
+    return (pgno_t *)( _keys( node ) + 2*tree->b_inner-1 );
+}
+
+static inline int
+_node_b( bptd_t *tree, disk_node_t *node )
+{
+    return node->type == BPLUS_TREE_LEAF ? tree->b_leaf : tree->b_inner;
+}
+
+static inline int
+_node_full( bptd_t *tree, disk_node_t *node )
+{
+    return node->n == 2*_node_b( tree, node )-1;
+}
+
+static inline int
+_child_index( disk_node_t *node, int key )
+{
+    int i = key_binary_search( _keys( node ), node->n, key );
+
+    return i < 0 ? -i - 1 : i;
+}
+
+/*
+ * Open the tree stored in path, creating it if the file is empty.
+ * budget is the number of bytes of pages kept in memory. Returns NULL
+ * if the file cannot be used or a page cannot hold 5 keys.
+ */
+bptd_t *
+bptdOpen( const char *path, int page_size, size_t budget )
+{
+    int avail = page_size - (int)sizeof(disk_node_t);
+    int b_leaf = ( avail / (int)( 2 * sizeof(int) ) + 1 ) / 2;
+    int b_inner = ( ( avail - (int)sizeof(pgno_t) ) / (int)( sizeof(int) + sizeof(pgno_t) ) + 1 ) / 2;
+    bptd_t *t;
+
+    if( b_leaf<3 || b_inner<3 )
+        return NULL;
+
+    t = (bptd_t *)malloc( sizeof(bptd_t) );
+    assert( t );
+
+    t->pager = pagerOpen( path, page_size, budget );
+    if( !t->pager ){
+        free( t );
+        return NULL;
+    }
+
+    t->b_leaf = b_leaf;
+    t->b_inner = b_inner;
+
+    return t;
+}
+
+/*
+ * Write every modified page back; returns 0 on success and -1 if a
+ * page could not be written or an earlier operation hit a page it
+ * could not read.
+ */
+int
+bptdSync( bptd_t *tree )
+{
+    return pagerSync( tree->pager );
+}
+
+int
+bptdClose( bptd_t *tree )
+{
+    int r;
+
+    if( !tree )
+        return 0;
+
+    r = pagerClose( tree->pager );
+    free( tree );
+
+    return r;
+}
+
+/* pinned leaf that would hold key, NULL if a page cannot be read */
+static disk_node_t *
+_leaf_seek( bptd_t *tree, int key )
+{
+    disk_node_t *node, *child;
+
+    if( tree->pager->root == PAGE_NONE )
+        return NULL;
+
+    node = pagerGet( tree->pager, tree->pager->root );
+
+    while( node && node->type == BPLUS_TREE_NON_LEAF ){
+        child = pagerGet( tree->pager, _children( tree, node )[ _child_index( node, key ) ] );
+        pagerUnpin( tree->pager, node );
+        node = child;
+    }
+
+    return node;
+}
+
+int
+bptdGet( bptd_t *tree, int key )
+{
+    int i, data = DATA_NOT_EXIST;
+    disk_node_t *leaf = _leaf_seek( tree, key );
+
+    if( !leaf )
+        return DATA_NOT_EXIST;
+
+    i = key_binary_search( _keys( leaf ), leaf->n, key );
+    if( i >= 0 )
+        data = _data( tree, leaf )[i];
+
+    pagerUnpin( tree->pager, leaf );
+
+    return data;
+}
+
+/*
+ * Call cb on every key in [lo, hi] in order; returns the number
+ * visited. A leaf that cannot be read ends the scan early.
+ */
+int
+bptdScan( bptd_t *tree, int lo, int hi, bpt_scan_cb cb, void *arg )
+{
+    int i, cnt = 0;
+    pgno_t next;
+    disk_node_t *leaf = _leaf_seek( tree, lo );
+
+    if( !leaf )
+        return 0;
+
+    i = _child_index( leaf, lo );
+
+    for( ;; ){
+        for( ; i<leaf->n; i++ ){
+            if( _keys( leaf )[i] > hi )
+                goto out;
+            cnt++;
+            if( cb && cb( _keys( leaf )[i], _data( tree, leaf )[i], arg ) )
+                goto out;
+        }
+
+        next = leaf->next;
+        pagerUnpin( tree->pager, leaf );
+        if( next == PAGE_NONE )
+            return cnt;
+
+        leaf = pagerGet( tree->pager, next );
+        if( !leaf )
+            return cnt;
+        i = 0;
+    }
+
+out:
+    pagerUnpin( tree->pager, leaf );
+    return cnt;
+}
+
+/*
+ * Split the full child y of x at index i into y and a new right
+ * sibling. As in the in-memory tree a leaf keeps its largest key as
+ * the separator, while a non-leaf moves its middle key up. Returns -1,
+ * changing nothing, if no page can be had for the sibling.
+ */
+static int
+_split_child( bptd_t *tree, disk_node_t *x, int i, disk_node_t *y )
+{
+    int t = _node_b( tree, y );
+    pgno_t zno;
+    disk_node_t *z = pagerNew( tree->pager, &zno );
+
+    if( !z )
+        return -1;
+
+    z->type = y->type;
+    z->n = t-1;
+    memcpy( _keys( z ), _keys( y ) + t, (t-1) * sizeof(int) );
+
+    if( y->type == BPLUS_TREE_LEAF ){
+        memcpy( _data( tree, z ), _data( tree, y ) + t, (t-1) * sizeof(int) );
+        y->n = t;
+        z->next = y->next;
+        y->next = zno;
+    }
+    else{
+        memcpy( _children( tree, z ), _children( tree, y ) + t, t * sizeof(pgno_t) );
+        y->n = t-1;
+    }
+
+    memmove( _keys( x ) + i+1, _keys( x ) + i, (x->n-i) * sizeof(int) );
+    memmove( _children( tree, x ) + i+2, _children( tree, x ) + i+1, (x->n-i) * sizeof(pgno_t) );
+    _keys( x )[i] = _keys( y )[t-1];
+    _children( tree, x )[i+1] = zno;
+    x->n++;
+
+    DISK_WRITE( tree, y );
+    DISK_WRITE( tree, z );
+    DISK_WRITE( tree, x );
+
+    pagerUnpin( tree->pager, z );
+
+    return 0;
+}
+
+static void
+_insert_nonfull( bptd_t *tree, disk_node_t *leaf, int key, int data )
+{
+    int i = key_binary_search( _keys( leaf ), leaf->n, key );
+
+    if( i >= 0 )
+        _data( tree, leaf )[i] = data;
+    else{
+        i = -i - 1;
+        memmove( _keys( leaf ) + i+1, _keys( leaf ) + i, (leaf->n-i) * sizeof(int) );
+        memmove( _data( tree, leaf ) + i+1, _data( tree, leaf ) + i, (leaf->n-i) * sizeof(int) );
+        _keys( leaf )[i] = key;
+        _data( tree, leaf )[i] = data;
+        leaf->n++;
+    }
+
+    DISK_WRITE( tree, leaf );
+}
+
+/*
+ * Insert top-down, splitting every full node on the way. If a page
+ * cannot be read or allocated the insert is dropped, leaving the splits
+ * made so far, and the pager reports the error on the next sync.
+ */
+void
+bptdPut( bptd_t *tree, int key, int data )
+{
+    int i;
+    pgno_t rno, no;
+    pager_t *p = tree->pager;
+    disk_node_t *node, *child, *r;
+
+    if( p->root == PAGE_NONE ){
+        node = pagerNew( p, &no );
+        if( !node )
+            return;
+        node->type = BPLUS_TREE_LEAF;
+        p->root = no;
+    }
+    else if( !( node = pagerGet( p, p->root ) ) )
+        return;
+
+    if( _node_full( tree, node ) ){
+        r = pagerNew( p, &rno );
+        if( !r ){
+            pagerUnpin( p, node );
+            return;
+        }
+        r->type = BPLUS_TREE_NON_LEAF;
+        _children( tree, r )[0] = p->root;
+        if( _split_child( tree, r, 0, node ) ){
+            pagerFree( p, rno, r );
+            pagerUnpin( p, node );
+            return;
+        }
+        pagerUnpin( p, node );
+        p->root = rno;
+        node = r;
+    }
+
+    while( node->type == BPLUS_TREE_NON_LEAF ){
+        i = _child_index( node, key );
+        child = pagerGet( p, _children( tree, node )[i] );
+
+        if( child && _node_full( tree, child ) ){
+            if( _split_child( tree, node, i, child ) ){
+                pagerUnpin( p, child );
+                child = NULL;
+            }
+            else if( key > _keys( node )[i] ){
+                pagerUnpin( p, child );
+                child = pagerGet( p, _children( tree, node )[i+1] );
+            }
+        }
+
+        pagerUnpin( p, node );
+        if( !child )
+            return;
+        node = child;
+    }
+
+    _insert_nonfull( tree, node, key, data );
+    pagerUnpin( p, node );
+}
+
+/* move the last entry of left into child, the idx-th child of parent */
+static void
+_move_key_right( bptd_t *tree, disk_node_t *parent, int idx, disk_node_t *left, disk_node_t *child )
+{
+    int *ck = _keys( child );
+
+    memmove( ck + 1, ck, child->n * sizeof(int) );
+
+    if( child->type == BPLUS_TREE_LEAF ){
+        memmove( _data( tree, child ) + 1, _data( tree, child ), child->n * sizeof(int) );
+        ck[0] = _keys( left )[left->n-1];
+        _data( tree, child )[0] = _data( tree, left )[left->n-1];
+        left->n--;
+        _keys( parent )[idx-1] = _keys( left )[left->n-1];
+    }
+    else{
+        memmove( _children( tree, child ) + 1, _children( tree, child ), (child->n+1) * sizeof(pgno_t) );
+        ck[0] = _keys( parent )[idx-1];
+        _children( tree, child )[0] = _children( tree, left )[left->n];
+        _keys( parent )[idx-1] = _keys( left )[left->n-1];
+        left->n--;
+    }
+    child->n++;
+
+    DISK_WRITE( tree, left );
+    DISK_WRITE( tree, child );
+    DISK_WRITE( tree, parent );
+}
+
+/* move the first entry of right into child, the idx-th child of parent */
+static void
+_move_key_left( bptd_t *tree, disk_node_t *parent, int idx, disk_node_t *child, disk_node_t *right )
+{
+    int *rk = _keys( right );
+
+    if( child->type == BPLUS_TREE_LEAF ){
+        _keys( child )[child->n] = rk[0];
+        _data( tree, child )[child->n] = _data( tree, right )[0];
+        _keys( parent )[idx] = rk[0];
+        memmove( _data( tree, right ), _data( tree, right ) + 1, (right->n-1) * sizeof(int) );
+    }
+    else{
+        _keys( child )[child->n] = _keys( parent )[idx];
+        _children( tree, child )[child->n+1] = _children( tree, right )[0];
+        _keys( parent )[idx] = rk[0];
+        memmove( _children( tree, right ), _children( tree, right ) + 1, right->n * sizeof(pgno_t) );
+    }
+    memmove( rk, rk + 1, (right->n-1) * sizeof(int) );
+    right->n--;
+    child->n++;
+
+    DISK_WRITE( tree, right );
+    DISK_WRITE( tree, child );
+    DISK_WRITE( tree, parent );
+}
+
+/*
+ * Merge right, the (s+1)-th child of parent, into left and free its
+ * page. Both hold the minimum number of keys.
+ */
+static void
+_merge_node( bptd_t *tree, disk_node_t *parent, int s, disk_node_t *left, disk_node_t *right, pgno_t rno )
+{
+    int n = left->n;
+
+    if( left->type == BPLUS_TREE_LEAF ){
+        memcpy( _keys( left ) + n, _keys( right ), right->n * sizeof(int) );
+        memcpy( _data( tree, left ) + n, _data( tree, right ), right->n * sizeof(int) );
+        left->n += right->n;
+        left->next = right->next;
+    }
+    else{
+        _keys( left )[n] = _keys( parent )[s];
+        memcpy( _keys( left ) + n+1, _keys( right ), right->n * sizeof(int) );
+        memcpy( _children( tree, left ) + n+1, _children( tree, right ), (right->n+1) * sizeof(pgno_t) );
+        left->n += right->n + 1;
+    }
+
+    memmove( _keys( parent ) + s, _keys( parent ) + s+1, (parent->n-s-1) * sizeof(int) );
+    memmove( _children( tree, parent ) + s+1, _children( tree, parent ) + s+2, (parent->n-s-1) * sizeof(pgno_t) );
+    parent->n--;
+
+    DISK_WRITE( tree, left );
+    DISK_WRITE( tree, parent );
+
+    pagerFree( tree->pager, rno, right );
+}
+
+/*
+ * Pin and return the idx-th child of parent, first giving it a key
+ * from a sibling or merging it with one if it holds the minimum, so
+ * that a deletion below never has to walk back up. *cno is set to the
+ * child's page, which changes if it was merged into its left sibling.
+ * NULL, with nothing changed, if one of the pages cannot be read.
+ */
+static disk_node_t *
+_pre_descend_child( bptd_t *tree, disk_node_t *parent, int idx, pgno_t *cno )
+{
+    pager_t *p = tree->pager;
+    pgno_t *children = _children( tree, parent );
+    disk_node_t *child, *left = NULL, *right = NULL;
+    int t;
+
+    *cno = children[idx];
+    child = pagerGet( p, *cno );
+    if( !child )
+        return NULL;
+    t = _node_b( tree, child );
+
+    if( child->n > t-1 )
+        return child;
+
+    if( idx > 0 && !( left = pagerGet( p, children[idx-1] ) ) ){
+        pagerUnpin( p, child );
+        return NULL;
+    }
+    if( idx < parent->n && !( right = pagerGet( p, children[idx+1] ) ) ){
+        if( left )
+            pagerUnpin( p, left );
+        pagerUnpin( p, child );
+        return NULL;
+    }
+
+    if( left && left->n > t-1 )
+        _move_key_right( tree, parent, idx, left, child );
+    else if( right && right->n > t-1 )
+        _move_key_left( tree, parent, idx, child, right );
+    else if( left ){
+        *cno = children[idx-1];
+        _merge_node( tree, parent, idx-1, left, child, children[idx] );
+        child = left;
+        left = NULL;
+    }
+    else{
+        _merge_node( tree, parent, idx, child, right, children[idx+1] );
+        right = NULL;
+    }
+
+    if( left )
+        pagerUnpin( p, left );
+    if( right )
+        pagerUnpin( p, right );
+
+    return child;
+}
+
+/*
+ * Delete top-down, fixing every minimal node on the way. As with
+ * bptdPut, a page that cannot be read drops the deletion.
+ */
+void
+bptdRemove( bptd_t *tree, int key )
+{
+    int i;
+    pgno_t no, cno;
+    pager_t *p = tree->pager;
+    disk_node_t *node, *child;
+
+    if( p->root == PAGE_NONE ){
+        printf("Empty tree! No deletion\n");
+        return;
+    }
+
+    no = p->root;
+    if( !( node = pagerGet( p, no ) ) )
+        return;
+
+    while( node->type == BPLUS_TREE_NON_LEAF ){
+        i = _child_index( node, key );
+        child = _pre_descend_child( tree, node, i, &cno );
+        if( !child ){
+            pagerUnpin( p, node );
+            return;
+        }
+
+        if( node->n == 0 ){
+            //only the root can lose its last key to a merge
+            p->root = cno;
+            pagerFree( p, no, node );
+        }
+        else
+            pagerUnpin( p, node );
+
+        no = cno;
+        node = child;
+    }
+
+    i = key_binary_search( _keys( node ), node->n, key );
+
+    if( i < 0 )
+        printf(" The key %d does not exist in the tree\n", key );
+    else{
+        memmove( _keys( node ) + i, _keys( node ) + i+1, (node->n-i-1) * sizeof(int) );
+        memmove( _data( tree, node ) + i, _data( tree, node ) + i+1, (node->n-i-1) * sizeof(int) );
+        node->n--;
+        DISK_WRITE( tree, node );
+    }
+
+    if( node->n == 0 && no == p->root ){
+        p->root = PAGE_NONE;
+        pagerFree( p, no, node );
+    }
+    else
+        pagerUnpin( p, node );
+}
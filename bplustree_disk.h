@@ -0,0 +1,72 @@
+/*  bplustree_disk.h
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+#ifndef _HEADER_BPLUSTREE_DISK_
+#define _HEADER_BPLUSTREE_DISK_
+
+#include "bplustree.h"
+#include "pager.h"
+
+/*
+ * B+ tree kept in a page file, one node per page, with children named
+ * by page number. Nodes are read through the pager's buffer pool, so
+ * only the budget given to bptdOpen stays in memory. Keys are unique:
+ * putting an existing key replaces its data. Separators follow the
+ * in-memory tree: key[i] is at least every key under children[i].
+ *
+ * A node page starts with this header, followed by the key array and
+ * then the data or children array.
+ */
+typedef struct disk_node {
+    int type;
+    int n;
+    pgno_t next;
+    int reserved;
+}disk_node_t;
+
+typedef struct disk_tree {
+    int b_leaf;
+    int b_inner;
+    pager_t *pager;
+}bptd_t;
+
+bptd_t * bptdOpen( const char *, int, size_t );
+int bptdClose( bptd_t * );
+int bptdSync( bptd_t * );
+int bptdGet( bptd_t *, int );
+void bptdPut( bptd_t *, int, int );
+void bptdRemove( bptd_t *, int );
+int bptdScan( bptd_t *, int, int, bpt_scan_cb, void * );
+#endif
@@ -0,0 +1,720 @@
+/*  bplustree_str.c
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "bplustree_str.h"
+
+#define NODES_PER_SLAB (64)
+
+typedef struct bstr {
+    const unsigned char *p;
+    int len;
+}bstr_t;
+
+/*
+ * Keys of a node unpacked into standalone strings. Modifications
+ * unpack the nodes involved, edit the key lists and pack them back,
+ * which recomputes each node's shared prefix.
+ */
+typedef struct key_list {
+    int n;
+    bstr_t *v;
+    unsigned char *bytes;
+}key_list_t;
+
+static int
+_bstr_cmp( const unsigned char *a, int alen, const unsigned char *b, int blen )
+{
+    int r = memcmp( a, b, alen < blen ? alen : blen );
+
+    if( r )
+        return r;
+
+    return alen - blen;
+}
+
+static int
+_bstr_lcp( const bstr_t *a, const bstr_t *b )
+{
+    int i = 0;
+    int len = a->len < b->len ? a->len : b->len;
+
+    while( i<len && a->p[i] == b->p[i] )
+        i++;
+
+    return i;
+}
+
+/* shortest prefix of right that sorts after left, given left < right */
+static bstr_t
+_bstr_sep( const bstr_t *left, const bstr_t *right )
+{
+    bstr_t sep;
+
+    sep.p = right->p;
+    sep.len = _bstr_lcp( left, right ) + 1;
+    assert( sep.len <= right->len );
+
+    return sep;
+}
+
+static inline const unsigned char *
+_suffix( str_node_t *node, int i )
+{
+    return node->buf + node->off[i];
+}
+
+static inline int
+_suffix_len( str_node_t *node, int i )
+{
+    return node->off[i+1] - node->off[i];
+}
+
+/*
+ * Number of keys in node smaller than key; *eq is set when the next
+ * key equals it. The shared prefix is compared once, then the binary
+ * search only looks at suffixes.
+ */
+static int
+_key_lower_bound( str_node_t *node, const unsigned char *key, int len, int *eq )
+{
+    int c, mid;
+    int low = -1;
+    int high = node->n;
+    int plen = node->plen;
+
+    *eq = 0;
+
+    if( node->n == 0 )
+        return 0;
+
+    c = memcmp( key, node->buf, len < plen ? len : plen );
+    if( c < 0 || ( c == 0 && len < plen ) )
+        return 0;
+    if( c > 0 )
+        return node->n;
+
+    key += plen;
+    len -= plen;
+
+    while( low + 1 < high ){
+        mid = low + ( high - low ) / 2;
+        if( _bstr_cmp( key, len, _suffix( node, mid ), _suffix_len( node, mid ) ) > 0 )
+            low = mid;
+        else
+            high = mid;
+    }
+
+    if( high < node->n && !_bstr_cmp( key, len, _suffix( node, high ), _suffix_len( node, high ) ) )
+        *eq = 1;
+
+    return high;
+}
+
+/* separators equal to key send it right */
+static int
+_child_index( str_node_t *node, const unsigned char *key, int len )
+{
+    int eq;
+    int i = _key_lower_bound( node, key, len, &eq );
+
+    return i + eq;
+}
+
+static void
+_keys_load( str_node_t *node, key_list_t *kl, int extra )
+{
+    int i, slen;
+    unsigned char *p;
+
+    kl->n = node->n;
+    kl->v = (bstr_t *) malloc( ( node->n + extra ) * sizeof(bstr_t) );
+    kl->bytes = (unsigned char *) malloc( node->n * node->plen + node->off[node->n] - node->off[0] + 1 );
+    assert( kl->v && kl->bytes );
+
+    for( i=0, p=kl->bytes; i<node->n; i++ ){
+        slen = _suffix_len( node, i );
+
+        memcpy( p, node->buf, node->plen );
+        memcpy( p + node->plen, _suffix( node, i ), slen );
+
+        kl->v[i].p = p;
+        kl->v[i].len = node->plen + slen;
+        p += kl->v[i].len;
+    }
+}
+
+static void
+_keys_free( key_list_t *kl )
+{
+    free( kl->v );
+    free( kl->bytes );
+}
+
+static void
+_keys_insert( key_list_t *kl, int pos, bstr_t key )
+{
+    memmove( &kl->v[pos+1], &kl->v[pos], ( kl->n - pos ) * sizeof(bstr_t) );
+    kl->v[pos] = key;
+    kl->n++;
+}
+
+static void
+_keys_delete( key_list_t *kl, int pos )
+{
+    kl->n--;
+    memmove( &kl->v[pos], &kl->v[pos+1], ( kl->n - pos ) * sizeof(bstr_t) );
+}
+
+/* pack n sorted keys into node, storing their common prefix once */
+static void
+_keys_store( str_node_t *node, bstr_t *v, int n )
+{
+    int i, need, plen = 0;
+
+    if( n > 0 )
+        plen = _bstr_lcp( &v[0], &v[n-1] );
+
+    for( i=0, need=plen; i<n; i++ )
+        need += v[i].len - plen;
+
+    if( need > node->size ){
+        node->buf = (unsigned char *) realloc( node->buf, need );
+        assert( node->buf );
+        node->size = need;
+    }
+
+    if( plen )
+        memcpy( node->buf, v[0].p, plen );
+
+    node->off[0] = plen;
+    for( i=0; i<n; i++ ){
+        memcpy( node->buf + node->off[i], v[i].p + plen, v[i].len - plen );
+        node->off[i+1] = node->off[i] + v[i].len - plen;
+    }
+
+    node->plen = plen;
+    node->n = n;
+}
+
+static void
+_str_node_init( str_node_t *node, int *off, int type )
+{
+    node->type = type;
+    node->n = 0;
+    node->plen = 0;
+    node->off = off;
+    node->off[0] = 0;
+    node->buf = NULL;
+    node->size = 0;
+}
+
+static str_nonleaf_t *
+str_non_leaf_new( bpts_t *tree )
+{
+    int nKeys = tree->b_factor*2-1;
+    str_nonleaf_t *new = (str_nonleaf_t *)slabAlloc( &tree->non_leaf_pool );
+
+    assert( new );
+
+    new->children = (str_node_t **)(new+1);
+    memset( new->children, 0, (nKeys+1) * sizeof(str_node_t *) );
+
+    _str_node_init( &new->node, (int *)(new->children+nKeys+1), BPLUS_TREE_NON_LEAF );
+
+    return new;
+}
+
+static str_leaf_t *
+str_leaf_new( bpts_t *tree )
+{
+    int nKeys = tree->b_factor*2-1;
+    str_leaf_t *new = (str_leaf_t *)slabAlloc( &tree->leaf_pool );
+
+    assert( new );
+
+    _str_node_init( &new->node, (int *)(new+1), BPLUS_TREE_LEAF );
+
+    new->data = new->node.off + nKeys+1;
+    new->next = NULL;
+
+    return new;
+}
+
+static void
+str_node_destroy( bpts_t *tree, str_node_t *node )
+{
+    free( node->buf );
+
+    if( node->type == BPLUS_TREE_LEAF )
+        slabFree( &tree->leaf_pool, node );
+    else
+        slabFree( &tree->non_leaf_pool, node );
+}
+
+static int
+_str_full( bpts_t *tree, str_node_t *node )
+{
+    return node->n == tree->b_factor*2-1;
+}
+
+int
+bptsGet( bpts_t *tree, const void *key, int len )
+{
+    int i, eq;
+    str_node_t *node = tree->root;
+
+    if( !node )
+        return DATA_NOT_EXIST;
+
+    while( node->type == BPLUS_TREE_NON_LEAF )
+        node = ((str_nonleaf_t *)node)->children[ _child_index( node, key, len ) ];
+
+    i = _key_lower_bound( node, key, len, &eq );
+
+    return eq ? ((str_leaf_t *)node)->data[i] : DATA_NOT_EXIST;
+}
+
+static void
+_str_split_child( bpts_t *tree, str_nonleaf_t *parent, int i )
+{
+    int j;
+    int t = tree->b_factor;
+    str_node_t *y, *z;
+    key_list_t ky, kp;
+    bstr_t sep;
+
+    y = parent->children[i];
+    _keys_load( y, &ky, 0 );
+
+    if( y->type == BPLUS_TREE_LEAF ){
+        str_leaf_t *y_ln = (str_leaf_t *)y;
+        str_leaf_t *z_ln = str_leaf_new( tree );
+
+        for( j=0; j<t-1; j++ )
+            z_ln->data[j] = y_ln->data[t+j];
+
+        _keys_store( y, ky.v, t );
+        _keys_store( &z_ln->node, ky.v+t, t-1 );
+
+        z_ln->next = y_ln->next;
+        y_ln->next = z_ln;
+
+        sep = _bstr_sep( &ky.v[t-1], &ky.v[t] );
+        z = &z_ln->node;
+    }
+    else{
+        str_nonleaf_t *y_nln = (str_nonleaf_t *)y;
+        str_nonleaf_t *z_nln = str_non_leaf_new( tree );
+
+        for( j=0; j<t; j++ )
+            z_nln->children[j] = y_nln->children[t+j];
+
+        _keys_store( y, ky.v, t-1 );
+        _keys_store( &z_nln->node, ky.v+t, t-1 );
+
+        sep = ky.v[t-1];
+        z = &z_nln->node;
+    }
+
+    for( j=parent->node.n+1; j>i+1; j-- )
+        parent->children[j] = parent->children[j-1];
+    parent->children[i+1] = z;
+
+    _keys_load( &parent->node, &kp, 1 );
+    _keys_insert( &kp, i, sep );
+    _keys_store( &parent->node, kp.v, kp.n );
+
+    _keys_free( &kp );
+    _keys_free( &ky );
+}
+
+/*
+ * Insert or replace key, splitting full nodes on the way down as
+ * bptPut does.
+ */
+void
+bptsPut( bpts_t *tree, const void *key, int len, int data )
+{
+    int i, j, eq;
+    str_node_t *node;
+    str_nonleaf_t *s;
+    str_leaf_t *ln;
+    key_list_t kl;
+    bstr_t k;
+
+    if( !tree->root ){
+        ln = str_leaf_new( tree );
+        tree->root = &ln->node;
+    }
+
+    if( _str_full( tree, tree->root ) ){
+        s = str_non_leaf_new( tree );
+        s->children[0] = tree->root;
+        tree->root = &s->node;
+        _str_split_child( tree, s, 0 );
+    }
+
+    node = tree->root;
+
+    while( node->type == BPLUS_TREE_NON_LEAF ){
+        s = (str_nonleaf_t *)node;
+        i = _child_index( node, key, len );
+
+        if( _str_full( tree, s->children[i] ) ){
+            _str_split_child( tree, s, i );
+            i = _child_index( node, key, len );
+        }
+
+        node = s->children[i];
+    }
+
+    ln = (str_leaf_t *)node;
+    i = _key_lower_bound( node, key, len, &eq );
+
+    if( eq ){
+        ln->data[i] = data;
+        return;
+    }
+
+    for( j=node->n; j>i; j-- )
+        ln->data[j] = ln->data[j-1];
+    ln->data[i] = data;
+
+    k.p = key;
+    k.len = len;
+
+    _keys_load( node, &kl, 1 );
+    _keys_insert( &kl, i, k );
+    _keys_store( node, kl.v, kl.n );
+    _keys_free( &kl );
+}
+
+/*
+ * Make sure child idx of parent has more than t-1 keys before
+ * descending into it, by borrowing from a sibling or merging with one.
+ */
+static str_node_t *
+_str_pre_descend_child( bpts_t *tree, str_node_t *parent, int idx )
+{
+    int j;
+    int t = tree->b_factor;
+    str_nonleaf_t *p = (str_nonleaf_t *)parent;
+    str_node_t *child, *lsibling, *rsibling;
+    key_list_t kp, kc, ks;
+
+    child = p->children[idx];
+
+    if( child->n > t-1 ) // not a minimal node
+        return child;
+
+    lsibling = idx > 0 ? p->children[idx-1] : NULL;
+    rsibling = idx < parent->n ? p->children[idx+1] : NULL;
+
+    _keys_load( parent, &kp, 0 );
+    _keys_load( child, &kc, 2*t );
+
+    if( lsibling && lsibling->n > t-1 ){
+        _keys_load( lsibling, &ks, 0 );
+
+        if( child->type == BPLUS_TREE_LEAF ){
+            str_leaf_t *c = (str_leaf_t *)child;
+            str_leaf_t *l = (str_leaf_t *)lsibling;
+
+            for( j=child->n; j>0; j-- )
+                c->data[j] = c->data[j-1];
+            c->data[0] = l->data[lsibling->n-1];
+
+            _keys_insert( &kc, 0, ks.v[ks.n-1] );
+            ks.n--;
+            kp.v[idx-1] = _bstr_sep( &ks.v[ks.n-1], &kc.v[0] );
+        }
+        else{
+            str_nonleaf_t *c = (str_nonleaf_t *)child;
+            str_nonleaf_t *l = (str_nonleaf_t *)lsibling;
+
+            for( j=child->n+1; j>0; j-- )
+                c->children[j] = c->children[j-1];
+            c->children[0] = l->children[lsibling->n];
+
+            _keys_insert( &kc, 0, kp.v[idx-1] );
+            kp.v[idx-1] = ks.v[ks.n-1];
+            ks.n--;
+        }
+
+        _keys_store( lsibling, ks.v, ks.n );
+    }
+    else if( rsibling && rsibling->n > t-1 ){
+        _keys_load( rsibling, &ks, 0 );
+
+        if( child->type == BPLUS_TREE_LEAF ){
+            str_leaf_t *c = (str_leaf_t *)child;
+            str_leaf_t *r = (str_leaf_t *)rsibling;
+
+            c->data[child->n] = r->data[0];
+            for( j=0; j<rsibling->n-1; j++ )
+                r->data[j] = r->data[j+1];
+
+            kc.v[kc.n++] = ks.v[0];
+            _keys_delete( &ks, 0 );
+            kp.v[idx] = _bstr_sep( &kc.v[kc.n-1], &ks.v[0] );
+        }
+        else{
+            str_nonleaf_t *c = (str_nonleaf_t *)child;
+            str_nonleaf_t *r = (str_nonleaf_t *)rsibling;
+
+            c->children[child->n+1] = r->children[0];
+            for( j=0; j<rsibling->n; j++ )
+                r->children[j] = r->children[j+1];
+
+            kc.v[kc.n++] = kp.v[idx];
+            kp.v[idx] = ks.v[0];
+            _keys_delete( &ks, 0 );
+        }
+
+        _keys_store( rsibling, ks.v, ks.n );
+    }
+    else{
+        str_node_t *left, *right;
+        key_list_t *kl, *kr;
+
+        //merge the minimal child with a minimal sibling, dropping separator sep
+        int sep = lsibling ? idx-1 : idx;
+
+        if( lsibling ){
+            _keys_load( lsibling, &ks, 2*t );
+            left = lsibling;
+            right = child;
+            kl = &ks;
+            kr = &kc;
+        }
+        else{
+            assert( rsibling );
+            _keys_load( rsibling, &ks, 0 );
+            left = child;
+            right = rsibling;
+            kl = &kc;
+            kr = &ks;
+        }
+
+        if( left->type == BPLUS_TREE_LEAF ){
+            str_leaf_t *l = (str_leaf_t *)left;
+            str_leaf_t *r = (str_leaf_t *)right;
+
+            for( j=0; j<right->n; j++ )
+                l->data[left->n+j] = r->data[j];
+            l->next = r->next;
+        }
+        else{
+            str_nonleaf_t *l = (str_nonleaf_t *)left;
+            str_nonleaf_t *r = (str_nonleaf_t *)right;
+
+            for( j=0; j<=right->n; j++ )
+                l->children[left->n+1+j] = r->children[j];
+            kl->v[kl->n++] = kp.v[sep];
+        }
+
+        for( j=0; j<kr->n; j++ )
+            kl->v[kl->n++] = kr->v[j];
+
+        _keys_delete( &kp, sep );
+        for( j=sep+1; j<parent->n; j++ )
+            p->children[j] = p->children[j+1];
+
+        _keys_store( left, kl->v, kl->n );
+        _keys_store( parent, kp.v, kp.n );
+        _keys_free( &ks );
+        _keys_free( &kc );
+        _keys_free( &kp );
+
+        str_node_destroy( tree, right );
+
+        return left;
+    }
+
+    //the moved keys point into the sibling's list, free it last
+    _keys_store( child, kc.v, kc.n );
+    _keys_store( parent, kp.v, kp.n );
+    _keys_free( &ks );
+    _keys_free( &kc );
+    _keys_free( &kp );
+
+    return child;
+}
+
+static void
+_str_descend( bpts_t *tree, str_node_t *node, const void *key, int len )
+{
+    int i, eq;
+    str_node_t *child;
+    str_leaf_t *ln;
+    key_list_t kl;
+
+    if( node->type == BPLUS_TREE_LEAF ){
+        i = _key_lower_bound( node, key, len, &eq );
+
+        if( !eq ){
+            printf(" The key %.*s does not exist in the tree\n", len, (const char *)key );
+            return;
+        }
+
+        ln = (str_leaf_t *)node;
+        memmove( &ln->data[i], &ln->data[i+1], ( node->n-i-1 ) * sizeof(int) );
+
+        _keys_load( node, &kl, 0 );
+        _keys_delete( &kl, i );
+        _keys_store( node, kl.v, kl.n );
+        _keys_free( &kl );
+
+        if( node->n==0 && node==tree->root ){
+            str_node_destroy( tree, node );
+            tree->root = NULL;
+        }
+        return;
+    }
+
+    child = _str_pre_descend_child( tree, node, _child_index( node, key, len ) );
+
+    _str_descend( tree, child, key, len );
+
+    if( node->n==0 && node==tree->root ){
+        str_node_destroy( tree, node );
+        tree->root = child;
+    }
+}
+
+void
+bptsRemove( bpts_t *tree, const void *key, int len )
+{
+    if( !tree->root )
+        printf("Empty tree! No deletion\n");
+    else
+        _str_descend( tree, tree->root, key, len );
+}
+
+/*
+ * Call cb on every pair with lo <= key <= hi in key order, handing it
+ * the full key. Returns the number of pairs visited.
+ */
+int
+bptsScan( bpts_t *tree, const void *lo, int lolen, const void *hi, int hilen,
+          bpts_scan_cb cb, void *arg )
+{
+    int i, eq, len, cnt = 0, size = 0;
+    unsigned char *key = NULL;
+    str_node_t *node = tree->root;
+    str_leaf_t *leaf;
+
+    if( !node )
+        return 0;
+
+    while( node->type == BPLUS_TREE_NON_LEAF )
+        node = ((str_nonleaf_t *)node)->children[ _child_index( node, lo, lolen ) ];
+
+    i = _key_lower_bound( node, lo, lolen, &eq );
+
+    for( leaf = (str_leaf_t *)node; leaf; leaf = leaf->next, i = 0 )
+        for( ; i<leaf->node.n; i++ ){
+            len = leaf->node.plen + _suffix_len( &leaf->node, i );
+            if( len > size ){
+                size = len * 2;
+                key = (unsigned char *) realloc( key, size );
+                assert( key );
+            }
+
+            memcpy( key, leaf->node.buf, leaf->node.plen );
+            memcpy( key + leaf->node.plen, _suffix( &leaf->node, i ), _suffix_len( &leaf->node, i ) );
+
+            if( _bstr_cmp( key, len, hi, hilen ) > 0 )
+                goto out;
+
+            cnt++;
+            if( cb( key, len, leaf->data[i], arg ) )
+                goto out;
+        }
+
+out:
+    free( key );
+
+    return cnt;
+}
+
+bpts_t *
+bptsInit( int b )
+{
+    int nKeys = 2*b-1;
+    bpts_t *t;
+
+    assert( b>2 );
+
+    t = ( bpts_t * ) malloc ( sizeof(bpts_t) );
+
+    if( t ){
+        t->b_factor = b;
+        t->root = NULL;
+        slabInit( &t->leaf_pool, sizeof(str_leaf_t) + (2*nKeys+1) * sizeof(int), NODES_PER_SLAB );
+        slabInit( &t->non_leaf_pool, sizeof(str_nonleaf_t) + (nKeys+1) * ( sizeof(str_node_t *) + sizeof(int) ), NODES_PER_SLAB );
+    }
+
+    return t;
+}
+
+/* node key buffers are allocated separately, so free them before the pools */
+static void
+_str_free_bufs( str_node_t *node )
+{
+    int i;
+
+    if( node->type == BPLUS_TREE_NON_LEAF )
+        for( i=0; i<=node->n; i++ )
+            _str_free_bufs( ((str_nonleaf_t *)node)->children[i] );
+
+    free( node->buf );
+}
+
+void
+bptsDestroy( bpts_t *tree )
+{
+    if( tree ){
+        if( tree->root )
+            _str_free_bufs( tree->root );
+        slabDestroy( &tree->leaf_pool );
+        slabDestroy( &tree->non_leaf_pool );
+        free( tree );
+    }
+}
@@ -0,0 +1,90 @@
+/*  bplustree_str.h
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+#ifndef _HEADER_BPLUSTREE_STR_
+#define _HEADER_BPLUSTREE_STR_
+
+#include "bplustree.h"
+
+/*
+ * B+ tree keyed by byte strings, compared with memcmp (a key that is a
+ * prefix of another sorts first). Keys are unique: putting an existing
+ * key replaces its data.
+ *
+ * Every node keeps its keys in one byte buffer: the prefix shared by all
+ * of its keys is stored once, followed by the remaining suffixes. The
+ * separator promoted by a leaf split is the shortest prefix of the right
+ * half's first key that still sorts after the left half's last key, so
+ * non-leaf nodes hold short keys even when the stored keys are long.
+ * Separators sort after every key of the left subtree and at or before
+ * every key of the right one.
+ */
+typedef struct str_node {
+    int type;
+    int n;
+    int plen;
+    int *off;
+    unsigned char *buf;
+    int size;
+}str_node_t;
+
+typedef struct str_non_leaf {
+    str_node_t node;
+    str_node_t **children;
+}str_nonleaf_t;
+
+typedef struct str_leaf {
+    str_node_t node;
+    struct str_leaf *next;
+    int *data;
+}str_leaf_t;
+
+typedef struct str_tree {
+    int b_factor;
+    str_node_t *root;
+    slab_t leaf_pool;
+    slab_t non_leaf_pool;
+}bpts_t;
+
+/* return non-zero to stop the scan */
+typedef int (*bpts_scan_cb)( const void *key, int len, int data, void *arg );
+
+bpts_t * bptsInit( int );
+void bptsDestroy( bpts_t * );
+int bptsGet( bpts_t *, const void *, int );
+void bptsPut( bpts_t *, const void *, int, int );
+void bptsRemove( bpts_t *, const void *, int );
+int bptsScan( bpts_t *, const void *, int, const void *, int, bpts_scan_cb, void * );
+#endif
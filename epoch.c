@@ -0,0 +1,208 @@
+/*  epoch.c
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "epoch.h"
+
+/* slot value of a thread outside any operation */
+#define EPOCH_IDLE (~0UL)
+/* retirements between two attempts to advance and reclaim */
+#define EPOCH_BATCH (64)
+
+/*
+ * Slots are process wide so that a thread keeps the same index in
+ * every epoch_t; the key destructor frees the slot at thread exit.
+ */
+static int slot_used[EPOCH_MAX_THREADS];
+static pthread_key_t slot_key;
+static pthread_once_t slot_once = PTHREAD_ONCE_INIT;
+static __thread int slot = -1;
+
+static void
+_slot_release( void *arg )
+{
+    __atomic_store_n( &slot_used[(long)arg - 1], 0, __ATOMIC_RELEASE );
+}
+
+static void
+_slot_key_init( void )
+{
+    pthread_key_create( &slot_key, _slot_release );
+}
+
+static int
+_slot_get( void )
+{
+    int i, unused;
+
+    if( slot >= 0 )
+        return slot;
+
+    pthread_once( &slot_once, _slot_key_init );
+
+    for( i=0; i<EPOCH_MAX_THREADS; i++ ){
+        unused = 0;
+        if( __atomic_compare_exchange_n( &slot_used[i], &unused, 1, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+            break;
+    }
+    assert( i < EPOCH_MAX_THREADS );
+
+    slot = i;
+    pthread_setspecific( slot_key, (void *)(long)( i + 1 ) );
+
+    return slot;
+}
+
+void
+epochInit( epoch_t *e, epoch_reclaim_fn reclaim, void *ctx )
+{
+    int i;
+
+    e->global = 0;
+    for( i=0; i<EPOCH_MAX_THREADS; i++ )
+        e->active[i].epoch = EPOCH_IDLE;
+
+    pthread_mutex_init( &e->lock, NULL );
+    e->retired = NULL;
+    e->nretired = 0;
+    e->cap = 0;
+    e->reclaim = reclaim;
+    e->ctx = ctx;
+}
+
+/* reclaim whatever is still retired; no thread may be inside e */
+void
+epochDestroy( epoch_t *e )
+{
+    epochFlush( e );
+    free( e->retired );
+    pthread_mutex_destroy( &e->lock );
+}
+
+void
+epochEnter( epoch_t *e )
+{
+    epoch_slot_t *s = &e->active[ _slot_get() ];
+
+    __atomic_store_n( &s->epoch, __atomic_load_n( &e->global, __ATOMIC_RELAXED ), __ATOMIC_RELAXED );
+    //publish the slot before any shared pointer is read
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+}
+
+void
+epochExit( epoch_t *e )
+{
+    __atomic_store_n( &e->active[slot].epoch, EPOCH_IDLE, __ATOMIC_RELEASE );
+}
+
+/*
+ * Advance the global epoch if every active thread has seen it, then
+ * reclaim the entries retired before the oldest active epoch. Called
+ * with e->lock held.
+ */
+static void
+_epoch_collect( epoch_t *e )
+{
+    int i, j;
+    unsigned long a, min = EPOCH_IDLE;
+
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+    for( i=0; i<EPOCH_MAX_THREADS; i++ ){
+        a = __atomic_load_n( &e->active[i].epoch, __ATOMIC_ACQUIRE );
+        if( a < min )
+            min = a;
+    }
+
+    if( min == EPOCH_IDLE || min == e->global ){
+        __atomic_store_n( &e->global, e->global + 1, __ATOMIC_RELAXED );
+        if( min == EPOCH_IDLE )
+            min = e->global;
+    }
+
+    for( i=0, j=0; i<e->nretired; i++ ){
+        if( e->retired[i].epoch < min )
+            e->reclaim( e->ctx, e->retired[i].ptr, e->retired[i].arg );
+        else
+            e->retired[j++] = e->retired[i];
+    }
+    e->nretired = j;
+}
+
+/*
+ * Defer freeing ptr, already unlinked from every shared structure,
+ * until no thread can still be reading it. arg is passed back to the
+ * reclaim callback.
+ */
+void
+epochRetire( epoch_t *e, void *ptr, void *arg )
+{
+    pthread_mutex_lock( &e->lock );
+
+    if( e->nretired == e->cap ){
+        e->cap = e->cap ? 2 * e->cap : EPOCH_BATCH;
+        e->retired = realloc( e->retired, e->cap * sizeof(epoch_retired_t) );
+        assert( e->retired );
+    }
+
+    e->retired[e->nretired].ptr = ptr;
+    e->retired[e->nretired].arg = arg;
+    e->retired[e->nretired].epoch = e->global;
+    e->nretired++;
+
+    if( e->nretired % EPOCH_BATCH == 0 )
+        _epoch_collect( e );
+
+    pthread_mutex_unlock( &e->lock );
+}
+
+/* reclaim every retired entry; no thread may be inside e */
+void
+epochFlush( epoch_t *e )
+{
+    int i;
+
+    pthread_mutex_lock( &e->lock );
+
+    for( i=0; i<e->nretired; i++ )
+        e->reclaim( e->ctx, e->retired[i].ptr, e->retired[i].arg );
+    e->nretired = 0;
+
+    pthread_mutex_unlock( &e->lock );
+}
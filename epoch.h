@@ -0,0 +1,82 @@
+/*  epoch.h
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+
+#ifndef _HEADER_EPOCH_
+#define _HEADER_EPOCH_
+
+#include <pthread.h>
+
+#define EPOCH_MAX_THREADS (128)
+
+/* called once no thread can still hold ptr */
+typedef void (*epoch_reclaim_fn)( void *ctx, void *ptr, void *arg );
+
+/*
+ * Epoch-based reclamation. Threads bracket every access to shared
+ * nodes with epochEnter and epochExit. A retired pointer is tagged
+ * with the global epoch and handed to the reclaim callback once every
+ * thread inside an operation has entered a later epoch. Each thread
+ * takes a slot on first use and gives it back when it exits.
+ */
+typedef struct epoch_slot {
+    unsigned long epoch;
+    char pad[64 - sizeof(unsigned long)];
+}epoch_slot_t;
+
+typedef struct epoch_retired {
+    void *ptr;
+    void *arg;
+    unsigned long epoch;
+}epoch_retired_t;
+
+typedef struct epoch {
+    unsigned long global;
+    epoch_slot_t active[EPOCH_MAX_THREADS];
+    pthread_mutex_t lock;
+    epoch_retired_t *retired;
+    int nretired;
+    int cap;
+    epoch_reclaim_fn reclaim;
+    void *ctx;
+}epoch_t;
+
+void epochInit( epoch_t *, epoch_reclaim_fn, void * );
+void epochDestroy( epoch_t * );
+void epochEnter( epoch_t * );
+void epochExit( epoch_t * );
+void epochRetire( epoch_t *, void *, void * );
+void epochFlush( epoch_t * );
+#endif
@@ -0,0 +1,89 @@
+/*  eytz.c
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "eytz.h"
+
+#define EYTZ_ALIGN (64)
+
+/* place seps[i..] at slot k and below in order; returns the next i */
+static int
+_fill( eytz_t *e, const int *seps, void **leaves, int i, int k )
+{
+    if( k <= e->n ){
+        i = _fill( e, seps, leaves, i, 2*k );
+        e->keys[k] = seps[i];
+        e->leaves[k] = leaves[i];
+        i++;
+        i = _fill( e, seps, leaves, i, 2*k+1 );
+    }
+
+    return i;
+}
+
+/*
+ * Index m leaves in key order, where seps[i], for i < m-1, is >= every
+ * key in leaves[i] and <= every key in leaves[i+1].
+ */
+eytz_t *
+eytzBuild( const int *seps, void **leaves, int m )
+{
+    eytz_t *e = (eytz_t *)malloc( sizeof(eytz_t) );
+
+    assert( e && m > 0 );
+
+    e->n = m-1;
+    e->leaves = (void **)malloc( m * sizeof(void *) );
+    if( posix_memalign( (void **)&e->keys, EYTZ_ALIGN, m * sizeof(int) ) )
+        e->keys = NULL;
+    assert( e->leaves && e->keys );
+
+    _fill( e, seps, leaves, 0, 1 );
+    e->keys[0] = 0;
+    e->leaves[0] = leaves[m-1];
+
+    return e;
+}
+
+void
+eytzFree( eytz_t *e )
+{
+    if( e ){
+        free( e->keys );
+        free( e->leaves );
+        free( e );
+    }
+}
@@ -0,0 +1,76 @@
+/*  eytz.h
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+
+#ifndef _HEADER_EYTZ_
+#define _HEADER_EYTZ_
+
+/*
+ * Static search index over the leaves of a frozen tree. The m-1
+ * separators between m leaves are stored in Eytzinger (BFS) order in
+ * one array, 1-based, so that the children of slot k are 2k and 2k+1
+ * and no pointers are followed on the way down. The 16 slots four
+ * levels below k share one 64-byte line, which is prefetched while
+ * the levels in between are searched.
+ *
+ * leaves[k] is the leaf whose separator sits in slot k; leaves[0] is
+ * the last leaf, reached by keys above every separator.
+ */
+typedef struct eytz {
+    int n;
+    int *keys;
+    void **leaves;
+}eytz_t;
+
+eytz_t * eytzBuild( const int *, void **, int );
+void eytzFree( eytz_t * );
+
+/* the first leaf whose separator is >= key */
+static inline void *
+eytzFind( const eytz_t *e, int key )
+{
+    unsigned int k = 1;
+
+    while( k <= (unsigned int)e->n ){
+        __builtin_prefetch( e->keys + 16*k );
+        k = 2*k + ( e->keys[k] < key );
+    }
+
+    //undo the right turns taken after the last left turn
+    k >>= __builtin_ffs( ~k );
+
+    return e->leaves[k];
+}
+#endif
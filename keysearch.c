@@ -0,0 +1,241 @@
+/*  keysearch.c
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+#include "keysearch.h"
+
+int
+key_binary_search(int *arr, int len, int key)
+{
+    int low = -1;
+    int high = len;
+    int mid;
+
+    while (low + 1 < high) {
+        mid = low + (high - low) / 2;
+        if (key > arr[mid]) 
+            low = mid;
+        else
+            high = mid;
+    }
+
+    if (high >= len || arr[high] != key) 
+        return -high - 1;
+    else 
+        return high;
+}
+
+int
+key_delta_rank( const void *arr, int width, int len, unsigned int delta )
+{
+    int i, pos = 0;
+    const unsigned char *d8 = (const unsigned char *)arr;
+    const unsigned short *d16 = (const unsigned short *)arr;
+
+    //branch-free: the deltas are sorted, so the count is the rank
+    if( width == 1 )
+        for( i=0; i<len; i++ )
+            pos += ( d8[i] < delta );
+    else
+        for( i=0; i<len; i++ )
+            pos += ( d16[i] < delta );
+
+    return pos;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+ * The vector searches narrow the range with binary steps until at most
+ * KEY_SCAN_WINDOW keys are left, then count the keys smaller than key
+ * over the whole window with compare + popcount. Since the array is
+ * sorted that count is the insertion point, and the scan has no
+ * data-dependent branches to mispredict.
+ */
+#define KEY_SCAN_WINDOW (64)
+
+static inline int
+_key_narrow( int *arr, int *low, int high, int key )
+{
+    int lo = *low;
+    int mid;
+
+    while( high - lo > KEY_SCAN_WINDOW ){
+        mid = lo + (high - lo) / 2;
+        if( key > arr[mid] )
+            lo = mid + 1;
+        else
+            high = mid;
+    }
+
+    *low = lo;
+
+    return high;
+}
+
+static inline int
+_key_result( int *arr, int len, int pos, int key )
+{
+    if( pos >= len || arr[pos] != key )
+        return -pos - 1;
+    else
+        return pos;
+}
+
+__attribute__((target("avx2")))
+static int
+key_avx2_search( int *arr, int len, int key )
+{
+    int i, lo = 0, hi, pos;
+    __m256i k, v;
+
+    hi = _key_narrow( arr, &lo, len, key );
+
+    k = _mm256_set1_epi32( key );
+    pos = lo;
+
+    for( i=lo; i+8<=hi; i+=8 ){
+        v = _mm256_loadu_si256( (__m256i *)(arr+i) );
+        v = _mm256_cmpgt_epi32( k, v );
+        pos += __builtin_popcount( _mm256_movemask_ps( _mm256_castsi256_ps(v) ) );
+    }
+
+    for( ; i<hi; i++ )
+        pos += ( key > arr[i] );
+
+    return _key_result( arr, len, pos, key );
+}
+
+__attribute__((target("sse2")))
+static int
+key_sse_search( int *arr, int len, int key )
+{
+    int i, lo = 0, hi, pos;
+    __m128i k, v;
+
+    hi = _key_narrow( arr, &lo, len, key );
+
+    k = _mm_set1_epi32( key );
+    pos = lo;
+
+    for( i=lo; i+4<=hi; i+=4 ){
+        v = _mm_loadu_si128( (__m128i *)(arr+i) );
+        v = _mm_cmpgt_epi32( k, v );
+        pos += __builtin_popcount( _mm_movemask_ps( _mm_castsi128_ps(v) ) );
+    }
+
+    for( ; i<hi; i++ )
+        pos += ( key > arr[i] );
+
+    return _key_result( arr, len, pos, key );
+}
+
+/*
+ * SSE2 has only signed byte and word compares, so the deltas and the
+ * probe are biased by flipping their top bit, which maps unsigned
+ * order onto signed order. A vector holds 16 1-byte or 8 2-byte
+ * deltas; the tail is counted one by one.
+ */
+__attribute__((target("sse2")))
+static int
+key_sse_delta_rank( const void *arr, int width, int len, unsigned int delta )
+{
+    int i = 0, pos = 0;
+    const unsigned char *d8 = (const unsigned char *)arr;
+    const unsigned short *d16 = (const unsigned short *)arr;
+    __m128i k, v;
+
+    if( width == 1 ){
+        //delta <= 0xff here, a larger one is above every key
+        k = _mm_set1_epi8( (char)( delta ^ 0x80 ) );
+        for( ; i+16<=len; i+=16 ){
+            v = _mm_xor_si128( _mm_loadu_si128( (const __m128i *)(d8+i) ), _mm_set1_epi8( (char)0x80 ) );
+            pos += __builtin_popcount( _mm_movemask_epi8( _mm_cmpgt_epi8( k, v ) ) );
+        }
+        for( ; i<len; i++ )
+            pos += ( d8[i] < delta );
+    }
+    else{
+        k = _mm_set1_epi16( (short)( delta ^ 0x8000 ) );
+        for( ; i+8<=len; i+=8 ){
+            v = _mm_xor_si128( _mm_loadu_si128( (const __m128i *)(d16+i) ), _mm_set1_epi16( (short)0x8000 ) );
+            //two mask bits per 16-bit lane
+            pos += __builtin_popcount( _mm_movemask_epi8( _mm_cmpgt_epi16( k, v ) ) ) / 2;
+        }
+        for( ; i<len; i++ )
+            pos += ( d16[i] < delta );
+    }
+
+    return pos;
+}
+
+delta_rank_fn
+keyDeltaRankSelect( void )
+{
+    __builtin_cpu_init();
+
+    if( __builtin_cpu_supports("sse2") )
+        return key_sse_delta_rank;
+
+    return key_delta_rank;
+}
+
+key_search_fn
+keySearchSelect( void )
+{
+    __builtin_cpu_init();
+
+    if( __builtin_cpu_supports("avx2") )
+        return key_avx2_search;
+    if( __builtin_cpu_supports("sse2") )
+        return key_sse_search;
+
+    return key_binary_search;
+}
+
+#else
+
+key_search_fn
+keySearchSelect( void )
+{
+    return key_binary_search;
+}
+
+delta_rank_fn
+keyDeltaRankSelect( void )
+{
+    return key_delta_rank;
+}
+
+#endif
@@ -2,8 +2,16 @@
 #include <stdio.h>
 #include <math.h>
 #include <assert.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "bplustree.h"
+#include "bplustree_str.h"
+#include "bplustree_disk.h"
 
 #define MAX (1<<10)
 #define TC_0_TRIAL (8192)
@@ -69,6 +77,83 @@ create_array( int *a, int n, int max ){
 
 }
 
+static int
+_scan_count( int key, int data, void *arg )
+{
+    assert( key == data );
+    (*(int *)arg)++;
+    return 0;
+}
+
+static int
+_scan_count_any( int key, int data, void *arg )
+{
+    (*(int *)arg)++;
+    return 0;
+}
+
+static int
+_str_scan_count( const void *key, int len, int data, void *arg )
+{
+    (*(int *)arg)++;
+    return 0;
+}
+
+/* order pairs by key, then by data, which holds the input position */
+static int
+_pair_cmp( const void *a, const void *b )
+{
+    const int *x = (const int *)a, *y = (const int *)b;
+
+    if( x[0] != y[0] )
+        return x[0] < y[0] ? -1 : 1;
+    return x[1] < y[1] ? -1 : x[1] > y[1];
+}
+
+/* assert that two trees have the same shape, keys and data */
+static void
+_same_tree( node_t *a, node_t *b )
+{
+    int i;
+
+    assert( a->type == b->type && a->n == b->n );
+    assert( memcmp( a->key, b->key, a->n * sizeof(int) ) == 0 );
+
+    if( a->type == BPLUS_TREE_LEAF ){
+        assert( memcmp( ((leaf_t *)a)->data, ((leaf_t *)b)->data, a->n * sizeof(int) ) == 0 );
+        assert( !((leaf_t *)a)->next == !((leaf_t *)b)->next );
+    }
+    else{
+        for( i=0; i<=a->n; i++ )
+            _same_tree( ((nonleaf_t *)a)->children[i], ((nonleaf_t *)b)->children[i] );
+    }
+}
+
+#define NTHREADS (4)
+
+struct worker {
+    bpt_t *t;
+    int id;
+    int n;
+};
+
+/* each thread owns the keys congruent to its id */
+static void *
+_concurrent_worker( void *arg )
+{
+    int i;
+    struct worker *w = (struct worker *)arg;
+
+    for( i=w->id+1; i<=w->n; i+=NTHREADS )
+        bptPut( w->t, i, i );
+    for( i=w->id+1; i<=w->n; i+=NTHREADS )
+        assert( bptGet( w->t, i ) == i );
+    for( i=w->id+1; i<=w->n; i+=NTHREADS )
+        bptRemove( w->t, i );
+
+    return NULL;
+}
+
 static void
 reset_array( int *a, int len )
 {
@@ -224,6 +309,745 @@ int main( int argc, char *argv[] ){
      bptDump(t);
     
 #endif
+#if 1
+     /* Range scan and cursor */
+     for (i = 1; i <= n; i++) {
+         bptPut(t, i, i);
+     }
+     {
+         int cnt = 0, got, total = 0;
+         int kbuf[16], dbuf[16];
+         bpt_cursor_t cur;
+
+         assert( bptScan(t, n/4+1, n/2, _scan_count, &cnt) == n/2-n/4 );
+         assert( cnt == n/2-n/4 );
+
+         bptCursorSeek(t, &cur, 0, n);
+         while( (got = bptCursorNext(&cur, kbuf, dbuf, 16)) > 0 ){
+             assert( kbuf[0] == total+1 );
+             total += got;
+         }
+         assert( total == n );
+         printf("scan [%d,%d]: %d keys, cursor: %d keys\n", n/4+1, n/2, cnt, total);
+     }
+     for (i = 1; i <= n; i++) {
+         bptRemove(t, i);
+     }
+#endif
+#if 1
+     /* Bulk load and ordered deletion */
+     {
+         int *bk = (int *)malloc( n * sizeof(int) );
+         int *bd = (int *)malloc( n * sizeof(int) );
+
+         for (i = 0; i < n; i++) {
+             bk[i] = i+1;
+             bd[i] = i+1;
+         }
+         assert( bptBulkLoad(t, bk, bd, n, 1.0) == 0 );
+         assert( bptBulkLoad(t, bk, bd, n, 1.0) == -1 );
+         for (i = 1; i <= n; i++) {
+             assert( bptGet(t, i) == i );
+         }
+         reset_array(bd, n);
+         bptGetBatch(t, bk, bd, n);
+         for (i = 0; i < n; i++) {
+             assert( bd[i] == i+1 );
+         }
+         bptDump(t);
+         for (i = 1; i <= n; i++) {
+             bptRemove(t, i);
+         }
+         bptDump(t);
+
+         free( bk );
+         free( bd );
+     }
+#endif
+#if 1
+     /* Structural statistics */
+     {
+         bpt_stats_t st;
+         bpt_t *ct = bptInit(b);
+         long nodes = 0;
+
+         for (i = 1; i <= n; i++) {
+             bptPut(ct, i, i);
+         }
+         for (i = 1; i <= n; i++) {
+             assert( bptGet(ct, i) == i );
+         }
+         bptStats(ct, &st);
+         for (i = 0; i < st.height; i++) {
+             nodes += st.nodes[i];
+         }
+         assert( st.keys == n && st.nodes[0] == 1 );
+         assert( st.min_leaf_fill > 0 && st.min_leaf_fill <= st.leaf_fill + 1e-9 && st.leaf_fill <= 1 );
+         assert( st.bytes > nodes * sizeof(node_t) );
+#ifdef BPT_STATS
+         assert( st.puts == n && st.gets == n );
+         assert( st.get_visits == (unsigned long)n * st.height );
+         assert( st.splits + st.height - 1 == nodes - 1 );
+#endif
+         printf("stats: height %d, %ld nodes, leaf fill %.2f (min %.2f), %zu bytes, %lu splits\n",
+                st.height, nodes, st.leaf_fill, st.min_leaf_fill, st.bytes, st.splits);
+
+         for (i = 1; i <= n; i++) {
+             bptRemove(ct, i);
+         }
+         bptStats(ct, &st);
+         assert( st.height == 0 && st.keys == 0 );
+#ifdef BPT_STATS
+         assert( st.removes == n && st.merges + st.borrows_left + st.borrows_right > 0 );
+#endif
+         bptDestroy(ct);
+     }
+#endif
+#if 1
+     /* Compaction of half-full leaves */
+     {
+         bpt_stats_t before, after;
+         int freed = 0, got;
+
+         for (i = 1; i <= n; i++) {
+             bptPut(t, i, i);
+         }
+         bptStats(t, &before);
+         do {
+             got = bptCompact(t, 8);
+             freed += got;
+         } while( got > 0 );
+         bptStats(t, &after);
+         for (i = 1; i <= n; i++) {
+             assert( bptGet(t, i) == i );
+         }
+         assert( after.keys == n && after.leaf_fill >= before.leaf_fill );
+         assert( after.nodes[after.height-1] == before.nodes[before.height-1] - freed );
+         printf("compact: %d leaves freed, leaf fill %.2f -> %.2f\n",
+                freed, before.leaf_fill, after.leaf_fill);
+         for (i = 1; i <= n; i++) {
+             bptRemove(t, i);
+         }
+     }
+#endif
+#if 1
+     /* Relaxed deletion */
+     {
+         bpt_stats_t before, after;
+
+         bptSetRelaxed(t, 1);
+         for (i = 1; i <= n; i++) {
+             bptPut(t, i, i);
+         }
+         for (i = 1; i <= n; i++) {
+             if( i%4 )
+                 bptRemove(t, i);
+         }
+         bptStats(t, &before);
+         bptRemove(t, n+1);
+         bptStats(t, &after);
+         assert( after.keys == before.keys && after.bytes == before.bytes );
+#ifdef BPT_STATS
+         assert( after.merges == before.merges && after.borrows_left == before.borrows_left );
+#endif
+         for (i = 1; i <= n; i++) {
+             assert( bptGet(t, i) == ( i%4 ? DATA_NOT_EXIST : i ) );
+         }
+         while( bptCompact(t, 8) > 0 )
+             ;
+         for (i = 4; i <= n; i += 4) {
+             assert( bptGet(t, i) == i );
+         }
+         //the rest goes through rebalancing deletion
+         bptSetRelaxed(t, 0);
+         for (i = 4; i <= n; i += 4) {
+             bptRemove(t, i);
+         }
+         assert( t->root == NULL );
+
+         //and the same with relaxed deletion from several threads
+         {
+             pthread_t th[NTHREADS];
+             struct worker w[NTHREADS];
+
+             bptSetRelaxed(t, 1);
+             bptSetConcurrent(t, 1);
+             for (i = 0; i < NTHREADS; i++) {
+                 w[i].t = t;
+                 w[i].id = i;
+                 w[i].n = n;
+                 pthread_create(&th[i], NULL, _concurrent_worker, &w[i]);
+             }
+             for (i = 0; i < NTHREADS; i++) {
+                 pthread_join(th[i], NULL);
+             }
+             bptSetConcurrent(t, 0);
+             bptSetRelaxed(t, 0);
+             assert( t->root == NULL );
+         }
+     }
+#endif
+#if 1
+     /* Frozen read-only index */
+     {
+         int cnt = 0, got, total = 0;
+         int kbuf[16], dbuf[16];
+         int *q = (int *)malloc( (n+2) * sizeof(int) );
+         int *out = (int *)malloc( (n+2) * sizeof(int) );
+         bpt_cursor_t cur;
+
+         for (i = 1; i <= n; i++) {
+             bptPut(t, 2*i, i);
+         }
+         assert( bptFreeze(t) == 0 && t->frozen );
+         for (i = 0; i <= 2*n+1; i++) {
+             assert( bptGet(t, i) == ( i%2 == 0 && i > 0 ? i/2 : DATA_NOT_EXIST ) );
+         }
+         for (i = 0; i < n+2; i++) {
+             q[i] = 2*i+1;
+         }
+         bptGetBatch(t, q, out, n+2);
+         for (i = 0; i < n+2; i++) {
+             assert( out[i] == DATA_NOT_EXIST );
+         }
+         assert( bptScan(t, 0, 2*n, _scan_count_any, &cnt) == n );
+         bptCursorSeek(t, &cur, 3, 2*n+5);
+         while( (got = bptCursorNext(&cur, kbuf, dbuf, 16)) > 0 ){
+             total += got;
+         }
+         assert( total == n-1 );
+
+         //the first write reverts the tree to mutable mode
+         bptPut(t, 1, 0);
+         assert( t->frozen == NULL && bptGet(t, 1) == 0 );
+         bptRemove(t, 1);
+         for (i = 1; i <= n; i++) {
+             bptRemove(t, 2*i);
+         }
+         assert( t->root == NULL );
+         free(q);
+         free(out);
+     }
+#endif
+#if 1
+     /* Learned routing layer */
+     {
+         bpt_stats_t st;
+         int *k = (int *)malloc( n * sizeof(int) );
+         int *d = (int *)malloc( n * sizeof(int) );
+         int *out = (int *)malloc( n * sizeof(int) );
+
+         for (i = 0; i < n; i++) {
+             k[i] = 3*i + (i%7 == 0);
+             d[i] = i;
+         }
+         bptSetLearned(t, 4);
+         assert( bptBulkLoad(t, k, d, n, 0.7) == 0 && t->model );
+         for (i = 0; i < n; i++) {
+             assert( bptGet(t, k[i]) == i && bptGet(t, k[i]+1) == DATA_NOT_EXIST );
+         }
+         assert( bptGet(t, -5) == DATA_NOT_EXIST && bptGet(t, 3*n+5) == DATA_NOT_EXIST );
+         bptStats(t, &st);
+         assert( st.model_segments > 0 && st.model_max_err <= 5 );
+         printf("learned: %d segments, max error %d, avg error %.2f\n",
+                st.model_segments, st.model_max_err, st.model_avg_err);
+
+         //dropped by the first write, trained again by bptFreeze
+         bptPut(t, -1, -1);
+         assert( t->model == NULL );
+         assert( bptFreeze(t) == 0 && t->model && t->frozen );
+         bptGetBatch(t, k, out, n);
+         for (i = 0; i < n; i++) {
+             assert( out[i] == i );
+         }
+         assert( bptGet(t, -1) == -1 );
+         bptRemoveRange(t, -1, 3*n);
+         assert( t->root == NULL && t->model == NULL );
+         bptSetLearned(t, 0);
+         free(k);
+         free(d);
+         free(out);
+     }
+#endif
+#if 1
+     /* Parallel build from unsorted input */
+     {
+         //enough pairs for every thread to get a share
+         int m = 40*n + (1<<16) + 7;
+         int *k = (int *)malloc( m * sizeof(int) );
+         int *d = (int *)malloc( m * sizeof(int) );
+         bpt_stats_t st;
+
+         for (i = 0; i < m; i++) {
+             k[i] = (int)( ( 7919L * i ) % m ) - m/2;
+             d[i] = k[i] * 2;
+         }
+         assert( bptBuildParallel(t, k, d, m, 4) == 0 );
+         assert( bptBuildParallel(t, k, d, m, 4) == -1 );
+         bptStats(t, &st);
+         assert( st.keys == m && st.leaf_fill > 0.99 );
+         for (i = 0; i < m; i++) {
+             assert( bptGet(t, k[i]) == k[i] * 2 );
+         }
+         assert( bptRemoveRange(t, -m, m) == m && t->root == NULL );
+
+         //random keys with duplicates give the tree bptBulkLoad builds
+         //from the same pairs stably sorted
+         {
+             int cnt = 0;
+             int *pairs = (int *)malloc( 2 * m * sizeof(int) );
+             bpt_t *r = bptInit(b);
+             node_t *leaf;
+
+             for (i = 0; i < m; i++) {
+                 k[i] = random_in_range(0, m/4) - m/8;
+                 d[i] = i;
+             }
+             assert( bptBuildParallel(t, k, d, m, 3) == 0 );
+
+             for (i = 0; i < m; i++) {
+                 pairs[2*i] = k[i];
+                 pairs[2*i+1] = d[i];
+             }
+             qsort(pairs, m, 2 * sizeof(int), _pair_cmp);
+             for (i = 0; i < m; i++) {
+                 k[i] = pairs[2*i];
+                 d[i] = pairs[2*i+1];
+             }
+             assert( bptBulkLoad(r, k, d, m, 1.0) == 0 );
+             _same_tree(t->root, r->root);
+
+             for (leaf = t->root; leaf->type == BPLUS_TREE_NON_LEAF; ) {
+                 leaf = ((nonleaf_t *)leaf)->children[0];
+             }
+             for ( ; leaf; leaf = (node_t *)((leaf_t *)leaf)->next) {
+                 cnt += leaf->n;
+             }
+             assert( cnt == m );
+
+             assert( bptRemoveRange(t, -m, m) == m && t->root == NULL );
+             bptDestroy(r);
+             free(pairs);
+         }
+         free(k);
+         free(d);
+     }
+#endif
+#if 1
+     /* Append mode */
+     {
+         bpt_stats_t st;
+
+         bptSetAppend(t, 1);
+         for (i = 1; i <= n; i++) {
+             bptPut(t, i, i);
+         }
+         //every leaf but the rightmost is full
+         bptStats(t, &st);
+         assert( st.keys == n );
+         assert( st.keys > ( st.nodes[st.height-1] - 1 ) * ( 2*t->b_leaf - 1 ) );
+         printf("append: leaf fill %.2f\n", st.leaf_fill);
+         bptPut(t, 0, 0);
+         for (i = 0; i <= n; i++) {
+             assert( bptGet(t, i) == i );
+             bptRemove(t, i);
+         }
+         bptSetAppend(t, 0);
+     }
+#endif
+#if 1
+     /* Batched insertion */
+     {
+         int *bk = (int *)malloc( n * sizeof(int) );
+         int *bd = (int *)malloc( n * sizeof(int) );
+         int cnt = 0;
+         bpt_t *wt;
+
+         //every key once, shuffled, in two batches
+         for (i = 0; i < n; i++) {
+             bk[i] = i+1;
+         }
+         shuffle_array(bk, n);
+         memcpy(bd, bk, n * sizeof(int));
+         bptPutBatch(t, bk, bd, n/2);
+         bptPutBatch(t, bk+n/2, bd+n/2, n-n/2);
+         for (i = 1; i <= n; i++) {
+             assert( bptGet(t, i) == i );
+         }
+         assert( bptScan(t, 1, n, _scan_count, &cnt) == n );
+         for (i = 1; i <= n; i++) {
+             bptRemove(t, i);
+         }
+
+         //a sorted batch through the log
+         unlink("bpt.wal");
+         unlink("bpt.wal.ckpt");
+         wt = bptInit(b);
+         assert( bptWalOpen(wt, "bpt.wal", 0) == 0 );
+         for (i = 0; i < n; i++) {
+             bk[i] = bd[i] = i+1;
+         }
+         bptPutBatch(wt, bk, bd, n);
+         bptDestroy(wt);
+         wt = bptInit(b);
+         assert( bptWalOpen(wt, "bpt.wal", 0) == 0 );
+         for (i = 1; i <= n; i++) {
+             assert( bptGet(wt, i) == i );
+         }
+         bptDestroy(wt);
+         unlink("bpt.wal");
+         unlink("bpt.wal.ckpt");
+         free(bk);
+         free(bd);
+     }
+#endif
+#if 1
+     /* Range deletion */
+     {
+         bpt_stats_t before, after;
+
+         for (i = 1; i <= n; i++) {
+             bptPut(t, i, i);
+         }
+         bptStats(t, &before);
+         assert( bptRemoveRange(t, n/4+1, 3*n/4) == 3*n/4 - n/4 );
+         assert( bptRemoveRange(t, n/4+1, 3*n/4) == 0 );
+         bptSetConcurrent(t, 1);
+         assert( bptRemoveRange(t, 1, n) == -1 );
+         bptSetConcurrent(t, 0);
+         bptStats(t, &after);
+         assert( after.keys == n - (3*n/4 - n/4) );
+         assert( after.nodes[after.height-1] < before.nodes[before.height-1] );
+         for (i = 1; i <= n; i++) {
+             assert( bptGet(t, i) == ( i > n/4 && i <= 3*n/4 ? DATA_NOT_EXIST : i ) );
+         }
+         assert( bptRemoveRange(t, 1, n) == n - (3*n/4 - n/4) );
+         assert( t->root == NULL );
+     }
+#endif
+#if 1
+     /* Upsert, insert-if-absent and replace */
+     {
+         int old;
+
+         for (i = 1; i <= n; i += 2) {
+             assert( bptReplace(t, i, i, &old) == 0 && old == DATA_NOT_EXIST );
+             assert( bptInsertIfAbsent(t, i, i, &old) == 0 && old == DATA_NOT_EXIST );
+         }
+         for (i = 1; i <= n; i++) {
+             assert( bptUpsert(t, i, -i, &old) == 0 && old == ( i%2 ? i : DATA_NOT_EXIST ) );
+         }
+         for (i = 1; i <= n; i++) {
+             assert( bptInsertIfAbsent(t, i, 0, &old) == 0 && old == -i );
+             assert( bptReplace(t, i, i, &old) == 0 && old == -i );
+             assert( bptGet(t, i) == i );
+         }
+         for (i = 1; i <= n; i++) {
+             bptRemove(t, i);
+         }
+         assert( t->root == NULL );
+     }
+#endif
+#if 1
+     /* Snapshot write and mmap'd read-only tree */
+     {
+         int cnt = 0, got, total = 0;
+         int kbuf[16], dbuf[16];
+         bpt_cursor_t cur;
+         bpt_t *s;
+
+         for (i = 1; i <= n; i++) {
+             bptPut(t, i, i);
+         }
+         assert( bptSnapshotWrite(t, "bpt.snap") == 0 );
+         s = bptSnapshotOpen("bpt.snap");
+         assert( s );
+         for (i = 1; i <= n; i++) {
+             assert( bptGet(s, i) == i );
+         }
+         assert( bptGet(s, n+1) == DATA_NOT_EXIST );
+         assert( bptRemoveRange(s, 1, n) == -1 );
+         assert( bptScan(s, n/4+1, n/2, _scan_count, &cnt) == n/2-n/4 );
+         bptCursorSeek(s, &cur, 0, n);
+         while( (got = bptCursorNext(&cur, kbuf, dbuf, 16)) > 0 ){
+             assert( kbuf[0] == total+1 && dbuf[0] == total+1 );
+             total += got;
+         }
+         assert( total == n );
+         printf("snapshot: scan %d keys, cursor %d keys\n", cnt, total);
+         bptDestroy(s);
+
+         //the same tree with delta-packed leaves
+         {
+             struct stat plain, packed;
+
+             assert( bptSnapshotWritePacked(t, "bpt.psnap") == 0 );
+             s = bptSnapshotOpen("bpt.psnap");
+             assert( s );
+             for (i = 0; i <= n+1; i++) {
+                 assert( bptGet(s, i) == ( i >= 1 && i <= n ? i : DATA_NOT_EXIST ) );
+             }
+             cnt = 0;
+             assert( bptScan(s, n/4+1, n/2, _scan_count, &cnt) == n/2-n/4 );
+             assert( stat("bpt.snap", &plain) == 0 && stat("bpt.psnap", &packed) == 0 );
+             assert( packed.st_size <= plain.st_size );
+             printf("packed snapshot: %ld bytes, plain: %ld bytes\n",
+                    (long)packed.st_size, (long)plain.st_size);
+             bptDestroy(s);
+             unlink("bpt.psnap");
+         }
+         unlink("bpt.snap");
+         for (i = 1; i <= n; i++) {
+             bptRemove(t, i);
+         }
+     }
+#endif
+#if 1
+     /* Packed in-memory leaves */
+     {
+         int cnt = 0, got, total = 0, pos, m = 20000;
+         int kbuf[16], dbuf[16], in[64], out[64];
+         bpt_cursor_t cur;
+         bpt_stats_t plain, packed;
+         const snap_node_t *leaf;
+         bpt_t *p;
+
+         for (i = 1; i <= n; i++) {
+             bptPut(t, i, i);
+         }
+         bptStats(t, &plain);
+         assert( bptPack(t) == 0 && t->packed && !t->root );
+         assert( bptPack(t) == -1 && bptFreeze(t) == -1 );
+         bptStats(t, &packed);
+         assert( packed.keys == n && packed.bytes < plain.bytes );
+         assert( packed.nodes[packed.height-1] <= plain.nodes[plain.height-1] );
+         for (i = 0; i <= n+1; i++) {
+             assert( bptGet(t, i) == ( i >= 1 && i <= n ? i : DATA_NOT_EXIST ) );
+         }
+         for (i = 0; i < 64; i++) {
+             in[i] = i*n/64 + 1;
+         }
+         bptGetBatch(t, in, out, 64);
+         for (i = 0; i < 64; i++) {
+             assert( out[i] == in[i] );
+         }
+         assert( bptScan(t, n/4+1, n/2, _scan_count, &cnt) == n/2-n/4 );
+         bptCursorSeek(t, &cur, 0, n);
+         while( (got = bptCursorNext(&cur, kbuf, dbuf, 16)) > 0 ){
+             assert( kbuf[0] == total+1 && dbuf[0] == total+1 );
+             total += got;
+         }
+         assert( total == n );
+         assert( bptSnapshotWrite(t, "bpt.snap") == 0 );
+         unlink("bpt.snap");
+         printf("packed: %ld leaves, %zu bytes; plain: %ld leaves, %zu bytes\n",
+                packed.nodes[packed.height-1], packed.bytes,
+                plain.nodes[plain.height-1], plain.bytes);
+
+         //the first write rebuilds mutable leaves
+         assert( bptPut(t, n+1, n+1) == 0 && !t->packed && !t->snap && t->root );
+         for (i = 1; i <= n+1; i++) {
+             assert( bptGet(t, i) == i );
+         }
+         for (i = 1; i <= n+1; i++) {
+             bptRemove(t, i);
+         }
+         assert( t->root == NULL );
+
+         //keys and data too wide for deltas in places
+         for (i = 1; i <= n; i++) {
+             bptPut(t, i + i/100*100000, i*i*31);
+         }
+         assert( bptPack(t) == 0 );
+         for (i = 1; i <= n; i++) {
+             assert( bptGet(t, i + i/100*100000) == i*i*31 );
+             assert( bptGet(t, i + i/100*100000 + 1) == ( i%100 == 99 || i == n ? DATA_NOT_EXIST : (i+1)*(i+1)*31 ) );
+         }
+         bptSetConcurrent(t, 1);
+         assert( !t->packed && bptGet(t, n + n/100*100000) == n*n*31 );
+         bptSetConcurrent(t, 0);
+         for (i = 1; i <= n; i++) {
+             bptRemove(t, i + i/100*100000);
+         }
+         assert( t->root == NULL );
+
+         //a page-sized leaf holds twice the pairs with 2-byte deltas
+         p = bptInitSized(256, 4096);
+         assert( p );
+         for (i = 1; i <= m; i++) {
+             bptPut(p, 2*i, i);
+         }
+         assert( bptPack(p) == 0 );
+         for (leaf = snapSeek(p->snap, INT_MIN, &pos); snapNext(leaf); leaf = snapNext(leaf)) {
+             assert( leaf->width == 2 && leaf->dwidth == 2 );
+             assert( leaf->n >= 2*(2*p->b_leaf-1) );
+         }
+         for (i = 1; i <= m; i++) {
+             assert( bptGet(p, 2*i) == i && bptGet(p, 2*i+1) == DATA_NOT_EXIST );
+         }
+         bptDestroy(p);
+     }
+#endif
+#if 1
+     /* Write-ahead log, checkpoint and recovery */
+     {
+         bpt_t *wt;
+
+         unlink("bpt.wal");
+         unlink("bpt.wal.ckpt");
+         wt = bptInit(b);
+         assert( bptWalOpen(wt, "bpt.wal", 0) == 0 );
+         for (i = 1; i <= n/2; i++) {
+             bptPut(wt, i, i);
+         }
+         assert( bptCheckpoint(wt) == 0 );
+         for (i = n/2+1; i <= n; i++) {
+             bptPut(wt, i, i);
+         }
+         for (i = 1; i <= n; i += 2) {
+             bptRemove(wt, i);
+         }
+         bptRemoveRange(wt, 3*n/4+1, n);
+         printf("wal: %lu syncs since the checkpoint\n", wt->wal->syncs);
+         bptDestroy(wt);
+
+         wt = bptInit(b);
+         assert( bptWalOpen(wt, "bpt.wal", 0) == 0 );
+         for (i = 1; i <= n; i++) {
+             assert( bptGet(wt, i) == ( i%2 || i > 3*n/4 ? DATA_NOT_EXIST : i ) );
+         }
+
+         //a failed log write is reported and latched until a checkpoint
+         {
+             int fd = open("bpt.wal", O_RDONLY), saved = dup(wt->wal->fd), old;
+
+             dup2(fd, wt->wal->fd);
+             assert( bptPut(wt, 1, 1) == -1 );
+             dup2(saved, wt->wal->fd);
+             assert( bptPut(wt, 3, 3) == -1 && bptRemove(wt, 2) == -1 );
+             assert( bptUpsert(wt, 7, 7, &old) == -1 && old == DATA_NOT_EXIST );
+             assert( bptReplace(wt, 7, 8, &old) == -1 && old == 7 );
+             assert( bptInsertIfAbsent(wt, 7, 9, &old) == -1 && old == 8 );
+             assert( bptCheckpoint(wt) == 0 && bptPut(wt, 5, 5) == 0 );
+             close(fd);
+             close(saved);
+         }
+         assert( bptWalClose(wt) == 0 );
+         bptDestroy(wt);
+
+         wt = bptInit(b);
+         assert( bptWalOpen(wt, "bpt.wal", 0) == 0 );
+         assert( bptGet(wt, 1) == 1 && bptGet(wt, 2) == DATA_NOT_EXIST );
+         assert( bptGet(wt, 3) == 3 && bptGet(wt, 5) == 5 && bptGet(wt, 7) == 8 );
+         bptDestroy(wt);
+         unlink("bpt.wal");
+         unlink("bpt.wal.ckpt");
+     }
+#endif
+#if 1
+     /* Byte-sized nodes picked by the tuner */
+     {
+         int inner_bytes, leaf_bytes;
+         bpt_t *st;
+
+         bptTune(n, &inner_bytes, &leaf_bytes);
+         printf("tuned node sizes: inner %d B, leaf %d B\n", inner_bytes, leaf_bytes);
+
+         st = bptInitSized(inner_bytes, leaf_bytes);
+         assert( st );
+         for (i = n; i > 0; i--) {
+             bptPut(st, i, i);
+         }
+         for (i = 1; i <= n; i++) {
+             assert( bptGet(st, i) == i );
+         }
+         for (i = 1; i <= n; i++) {
+             bptRemove(st, i);
+         }
+         assert( st->root == NULL );
+         bptDestroy( st );
+     }
+#endif
+#if 1
+     /* Byte-string keys */
+     {
+         char sk[64];
+         int cnt = 0;
+         bpts_t *s = bptsInit(b);
+
+         for (i = 1; i <= n; i++) {
+             sprintf(sk, "/tenant%d/object/%06d", i%4, i);
+             bptsPut(s, sk, strlen(sk), i);
+         }
+         for (i = 1; i <= n; i++) {
+             sprintf(sk, "/tenant%d/object/%06d", i%4, i);
+             assert( bptsGet(s, sk, strlen(sk)) == i );
+         }
+         assert( bptsScan(s, "/tenant1/", 9, "/tenant1/~", 10, _str_scan_count, &cnt) == (n+3)/4 );
+         for (i = 1; i <= n; i++) {
+             sprintf(sk, "/tenant%d/object/%06d", i%4, i);
+             bptsRemove(s, sk, strlen(sk));
+         }
+         assert( s->root == NULL );
+         bptsDestroy( s );
+     }
+#endif
+#if 1
+     /* Disk-backed tree with an 8 page buffer pool */
+     {
+         bptd_t *d = bptdOpen("bptd.db", 256, 8*256);
+
+         for (i = 1; i <= n; i++) {
+             bptdPut(d, i, i);
+         }
+         assert( bptdClose(d) == 0 );
+
+         d = bptdOpen("bptd.db", 256, 8*256);
+         for (i = 1; i <= n; i++) {
+             assert( bptdGet(d, i) == i );
+         }
+         assert( bptdScan(d, 1, n/2, NULL, NULL) == n/2 );
+         for (i = 1; i <= n; i++) {
+             bptdRemove(d, i);
+         }
+         assert( d->pager->root == PAGE_NONE );
+
+         //a failed write-back is reported and retried by the next sync
+         {
+             int fd = open("bptd.db", O_RDONLY), saved = dup(d->pager->fd);
+
+             bptdPut(d, 1, 1);
+             dup2(fd, d->pager->fd);
+             assert( bptdSync(d) == -1 );
+             dup2(saved, d->pager->fd);
+             assert( bptdSync(d) == 0 && bptdGet(d, 1) == 1 );
+             close(fd);
+             close(saved);
+         }
+         assert( bptdClose(d) == 0 );
+         unlink("bptd.db");
+     }
+#endif
+#if 1
+     /* Concurrent insertion, query and deletion */
+     {
+         pthread_t th[NTHREADS];
+         struct worker w[NTHREADS];
+
+         bptSetConcurrent(t, 1);
+         for (i = 0; i < NTHREADS; i++) {
+             w[i].t = t;
+             w[i].id = i;
+             w[i].n = n;
+             pthread_create(&th[i], NULL, _concurrent_worker, &w[i]);
+         }
+         for (i = 0; i < NTHREADS; i++) {
+             pthread_join(th[i], NULL);
+         }
+         bptSetConcurrent(t, 0);
+         assert( t->root == NULL );
+     }
+#endif
 #if 1     
      create_array( &keys[0], MAX, MAX );
      
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <map>
+#include <memory>
+
+#include "bplustree.hpp"
+
+/*
+ * Random insertions and deletions checked against std::map, with
+ * 64-bit keys and move-only values.
+ */
+static uint32_t
+random_key( int range )
+{
+    return (uint32_t)( rand() % range );
+}
+
+template < int LeafCap, int InnerCap >
+static void
+test_random( int n, int range )
+{
+    int i;
+    BPlusTree< uint64_t, std::unique_ptr<uint64_t>, LeafCap, InnerCap > t;
+    std::map< uint64_t, uint64_t > ref;
+
+    for( i = 0; i < n; i++ ){
+        uint64_t key = ( (uint64_t)random_key( range ) << 32 ) | 7;
+
+        if( rand() % 3 ){
+            if( !ref.count( key ) ){
+                t.put( key, std::unique_ptr<uint64_t>( new uint64_t( key+1 ) ) );
+                ref[key] = key+1;
+            }
+        }
+        else
+            assert( t.remove( key ) == ( ref.erase( key ) == 1 ) );
+    }
+
+    assert( t.size() == ref.size() );
+
+    for( auto &kv : ref ){
+        std::unique_ptr<uint64_t> *v = t.get( kv.first );
+        assert( v && **v == kv.second );
+    }
+
+    std::map< uint64_t, uint64_t >::iterator it = ref.begin();
+    size_t cnt = t.scan( 0, UINT64_MAX, [&]( const uint64_t &k, std::unique_ptr<uint64_t> &v ){
+        assert( it != ref.end() && it->first == k && *v == it->second );
+        ++it;
+        return false;
+    } );
+    assert( cnt == ref.size() );
+
+    for( auto &kv : ref )
+        assert( t.remove( kv.first ) );
+
+    assert( t.empty() );
+    printf( "BPlusTree<%d,%d>: %d ops ok\n", LeafCap, InnerCap, n );
+}
+
+int main( int argc, char *argv[] ){
+
+    int n = argc > 1 ? atoi( argv[1] ) : 100000;
+
+    test_random< 5, 5 >( n, 2000 );
+    test_random< 7, 5 >( n, 5000 );
+    test_random< 63, 31 >( n, 50000 );
+
+    return 0;
+}
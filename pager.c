@@ -0,0 +1,385 @@
+/*  pager.c
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pager.h"
+
+#define PAGER_MAGIC (0x42505447)
+#define PAGER_ALIGN (64)
+/* a tree operation pins a node, its parent and two more */
+#define PAGER_MIN_FRAMES (8)
+
+typedef struct pager_meta {
+    unsigned int magic;
+    int page_size;
+    pgno_t npages;
+    pgno_t free;
+    pgno_t root;
+}pager_meta_t;
+
+static inline char *
+_frame_page( pager_t *p, int f )
+{
+    return p->pages + (size_t)f * p->page_size;
+}
+
+static inline int
+_page_frame( pager_t *p, void *page )
+{
+    return ( (char *)page - p->pages ) / p->page_size;
+}
+
+static inline int
+_bucket( pager_t *p, pgno_t pgno )
+{
+    return ( pgno * 2654435761u ) & p->mask;
+}
+
+static int
+_lookup( pager_t *p, pgno_t pgno )
+{
+    int f;
+
+    for( f = p->buckets[ _bucket( p, pgno ) ]; f >= 0; f = p->frames[f].next )
+        if( p->frames[f].pgno == pgno )
+            return f;
+
+    return -1;
+}
+
+static void
+_unhash( pager_t *p, int f )
+{
+    int *link = &p->buckets[ _bucket( p, p->frames[f].pgno ) ];
+
+    while( *link != f )
+        link = &p->frames[*link].next;
+    *link = p->frames[f].next;
+}
+
+/* write frame f back; it stays dirty if the write fails */
+static int
+_write_frame( pager_t *p, int f )
+{
+    ssize_t r = pwrite( p->fd, _frame_page( p, f ), p->page_size,
+                        (off_t)p->frames[f].pgno * p->page_size );
+
+    if( r != p->page_size ){
+        printf("Pager: write of page %u failed\n", p->frames[f].pgno);
+        return -1;
+    }
+
+    p->frames[f].dirty = 0;
+    p->writes++;
+
+    return 0;
+}
+
+/*
+ * CLOCK: sweep the frames, giving every referenced page a second chance,
+ * and take the first unpinned page that was not referenced since the
+ * last sweep. A dirty page that cannot be written back is passed over.
+ * Returns -1 if no frame can be freed.
+ */
+static int
+_evict( pager_t *p )
+{
+    int f, scanned;
+
+    for( scanned = 0; scanned < 2 * p->nframes; scanned++ ){
+        f = p->hand;
+        p->hand = ( p->hand + 1 ) % p->nframes;
+
+        if( p->frames[f].pin )
+            continue;
+        if( p->frames[f].ref ){
+            p->frames[f].ref = 0;
+            continue;
+        }
+
+        if( p->frames[f].pgno != PAGE_NONE ){
+            if( p->frames[f].dirty && _write_frame( p, f ) )
+                continue;
+            _unhash( p, f );
+            p->frames[f].pgno = PAGE_NONE;
+        }
+        return f;
+    }
+
+    printf("Pager: no frame can be evicted\n");
+    return -1;
+}
+
+/*
+ * Pin pgno in a frame, reading it from the file if read is set.
+ * Returns -1, and latches the error, if no frame is free or the page
+ * cannot be read in full.
+ */
+static int
+_fetch( pager_t *p, pgno_t pgno, int read )
+{
+    int f = _lookup( p, pgno );
+    int h;
+    ssize_t r;
+
+    if( f < 0 ){
+        f = _evict( p );
+        if( f < 0 ){
+            p->error = -1;
+            return -1;
+        }
+
+        if( read ){
+            r = pread( p->fd, _frame_page( p, f ), p->page_size, (off_t)pgno * p->page_size );
+            if( r != p->page_size ){
+                printf("Pager: read of page %u failed\n", pgno);
+                p->error = -1;
+                return -1;
+            }
+            p->reads++;
+        }
+
+        h = _bucket( p, pgno );
+        p->frames[f].pgno = pgno;
+        p->frames[f].dirty = 0;
+        p->frames[f].next = p->buckets[h];
+        p->buckets[h] = f;
+    }
+
+    p->frames[f].pin++;
+    p->frames[f].ref = 1;
+
+    return f;
+}
+
+/*
+ * Open or create the page file at path. budget caps the bytes kept in
+ * memory and must hold at least 8 pages. Returns NULL if the file
+ * cannot be opened or was written with another page size.
+ */
+pager_t *
+pagerOpen( const char *path, int page_size, size_t budget )
+{
+    int i, nbuckets;
+    pager_t *p;
+    pager_meta_t meta;
+    ssize_t r;
+
+    assert( page_size >= (int)sizeof(pager_meta_t) && ( page_size & (page_size-1) ) == 0 );
+
+    if( budget / page_size < PAGER_MIN_FRAMES ){
+        printf("Budget of %zu bytes holds fewer than %d pages\n", budget, PAGER_MIN_FRAMES);
+        return NULL;
+    }
+
+    p = (pager_t *)malloc( sizeof(pager_t) );
+    assert( p );
+
+    p->fd = open( path, O_RDWR | O_CREAT, 0644 );
+    if( p->fd < 0 ){
+        printf("Cannot open %s\n", path);
+        free( p );
+        return NULL;
+    }
+
+    r = pread( p->fd, &meta, sizeof(meta), 0 );
+    if( r == 0 ){
+        meta.magic = PAGER_MAGIC;
+        meta.page_size = page_size;
+        meta.npages = 1;
+        meta.free = PAGE_NONE;
+        meta.root = PAGE_NONE;
+    }
+    else if( r != sizeof(meta) || meta.magic != PAGER_MAGIC || meta.page_size != page_size ){
+        printf("%s is not a page file with %d byte pages\n", path, page_size);
+        close( p->fd );
+        free( p );
+        return NULL;
+    }
+
+    p->page_size = page_size;
+    p->nframes = budget / page_size;
+    p->npages = meta.npages;
+    p->free = meta.free;
+    p->root = meta.root;
+    p->hand = 0;
+    p->reads = 0;
+    p->writes = 0;
+    p->error = 0;
+
+    for( nbuckets = 1; nbuckets < p->nframes * 2; nbuckets *= 2 )
+        ;
+    p->mask = nbuckets - 1;
+
+    p->frames = (frame_t *)calloc( p->nframes, sizeof(frame_t) );
+    p->buckets = (int *)malloc( nbuckets * sizeof(int) );
+    i = posix_memalign( (void **)&p->pages, PAGER_ALIGN, (size_t)p->nframes * page_size );
+    assert( p->frames && p->buckets && i == 0 );
+
+    for( i=0; i<nbuckets; i++ )
+        p->buckets[i] = -1;
+
+    return p;
+}
+
+/*
+ * Write back every dirty page and the meta page, then sync the file.
+ * Returns -1 if a page could not be written, leaving the meta page
+ * alone so that it never points past what reached the file, or if an
+ * earlier read or eviction failed.
+ */
+int
+pagerSync( pager_t *p )
+{
+    int f, r = 0;
+    pager_meta_t meta;
+
+    for( f=0; f<p->nframes; f++ )
+        if( p->frames[f].pgno != PAGE_NONE && p->frames[f].dirty && _write_frame( p, f ) )
+            r = -1;
+
+    if( r || p->error )
+        return -1;
+
+    memset( &meta, 0, sizeof(meta) );
+    meta.magic = PAGER_MAGIC;
+    meta.page_size = p->page_size;
+    meta.npages = p->npages;
+    meta.free = p->free;
+    meta.root = p->root;
+
+    if( pwrite( p->fd, &meta, sizeof(meta), 0 ) != sizeof(meta) )
+        return -1;
+
+    return fsync( p->fd );
+}
+
+int
+pagerClose( pager_t *p )
+{
+    int r;
+
+    if( !p )
+        return 0;
+
+    r = pagerSync( p );
+
+    close( p->fd );
+    free( p->frames );
+    free( p->buckets );
+    free( p->pages );
+    free( p );
+
+    return r;
+}
+
+/*
+ * Pin page pgno; the pointer stays valid until pagerUnpin. NULL if
+ * the page cannot be read.
+ */
+void *
+pagerGet( pager_t *p, pgno_t pgno )
+{
+    int f;
+
+    assert( pgno != PAGE_NONE && pgno < p->npages );
+
+    f = _fetch( p, pgno, 1 );
+
+    return f < 0 ? NULL : _frame_page( p, f );
+}
+
+/*
+ * Pin a new zeroed page, reusing a freed one if there is any. NULL if
+ * no frame can be had for it.
+ */
+void *
+pagerNew( pager_t *p, pgno_t *pgno )
+{
+    int f;
+    char *page;
+
+    if( p->free != PAGE_NONE ){
+        f = _fetch( p, p->free, 1 );
+        if( f < 0 )
+            return NULL;
+        *pgno = p->free;
+        p->free = *(pgno_t *)_frame_page( p, f );
+    }
+    else{
+        f = _fetch( p, p->npages, 0 );
+        if( f < 0 )
+            return NULL;
+        *pgno = p->npages++;
+    }
+
+    page = _frame_page( p, f );
+    memset( page, 0, p->page_size );
+    p->frames[f].dirty = 1;
+
+    return page;
+}
+
+void
+pagerUnpin( pager_t *p, void *page )
+{
+    int f = _page_frame( p, page );
+
+    assert( p->frames[f].pin > 0 );
+    p->frames[f].pin--;
+}
+
+void
+pagerDirty( pager_t *p, void *page )
+{
+    p->frames[ _page_frame( p, page ) ].dirty = 1;
+}
+
+/* put the pinned page pgno on the free list and unpin it */
+void
+pagerFree( pager_t *p, pgno_t pgno, void *page )
+{
+    *(pgno_t *)page = p->free;
+    p->free = pgno;
+
+    pagerDirty( p, page );
+    pagerUnpin( p, page );
+}
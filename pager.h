@@ -0,0 +1,92 @@
+/*  pager.h
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+
+#ifndef _HEADER_PAGER_
+#define _HEADER_PAGER_
+
+#include <stddef.h>
+
+typedef unsigned int pgno_t;
+
+/* page 0 holds the pager's meta data, so it never names a node */
+#define PAGE_NONE (0)
+
+/*
+ * Buffer pool over a file of fixed-size pages. At most budget bytes of
+ * pages are resident; pagerGet pins a page in a frame and pagerUnpin
+ * releases it. When every frame is taken, an unpinned one is evicted
+ * with the CLOCK algorithm, writing it back first if it was marked
+ * dirty. Freed pages are chained into a free list and reused.
+ *
+ * A page that cannot be written back stays dirty and is retried by
+ * the next sync. A page that cannot be read makes pagerGet and
+ * pagerNew return NULL and is latched in error, so that pagerSync and
+ * pagerClose report it even if the caller did not.
+ */
+typedef struct frame {
+    pgno_t pgno;
+    int pin;
+    int ref;
+    int dirty;
+    int next;
+}frame_t;
+
+typedef struct pager {
+    int fd;
+    int page_size;
+    int nframes;
+    frame_t *frames;
+    char *pages;
+    int *buckets;
+    int mask;
+    int hand;
+    pgno_t npages;
+    pgno_t free;
+    pgno_t root;
+    unsigned long reads;
+    unsigned long writes;
+    int error;
+}pager_t;
+
+pager_t * pagerOpen( const char *, int, size_t );
+int pagerClose( pager_t * );
+void *pagerGet( pager_t *, pgno_t );
+void *pagerNew( pager_t *, pgno_t * );
+void pagerUnpin( pager_t *, void * );
+void pagerDirty( pager_t *, void * );
+void pagerFree( pager_t *, pgno_t, void * );
+int pagerSync( pager_t * );
+#endif
@@ -0,0 +1,135 @@
+/*  plm.c
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+#include <stdlib.h>
+#include <assert.h>
+#include <float.h>
+
+#include "plm.h"
+
+/*
+ * Fit segments greedily left to right. A segment keeps the range of
+ * slopes that still predict every separator it covers within eps and
+ * is closed when the next separator leaves that range empty. Slopes
+ * stay >= 0 so predictions never decrease inside a segment. Only the
+ * first of equal separators is fitted, it is the one lookups want.
+ */
+static int
+_fit( plm_t *p, int eps )
+{
+    int i, n = 0;
+    double dx, lo = 0, hi = DBL_MAX, smin, smax;
+    plm_seg_t *s = p->segs;
+
+    s->key = p->keys[0];
+    s->pos = 0;
+
+    for( i=1; i<p->m; i++ ){
+        if( p->keys[i] == p->keys[i-1] )
+            continue;
+
+        dx = (double)p->keys[i] - s->key;
+        smin = ( i - eps - s->pos ) / dx;
+        smax = ( i + eps - s->pos ) / dx;
+
+        if( smin > hi || smax < lo ){
+            s->slope = hi == DBL_MAX ? lo : ( lo + hi ) / 2;
+            s = &p->segs[++n];
+            s->key = p->keys[i];
+            s->pos = i;
+            lo = 0;
+            hi = DBL_MAX;
+            continue;
+        }
+
+        if( smin > lo )
+            lo = smin;
+        if( smax < hi )
+            hi = smax;
+    }
+    s->slope = hi == DBL_MAX ? lo : ( lo + hi ) / 2;
+
+    return n+1;
+}
+
+/* train a model over m separators in key order */
+plm_t *
+plmBuild( const int *keys, void **vals, int m, int eps )
+{
+    int i, j, err;
+    double sum = 0;
+    plm_t *p = (plm_t *)malloc( sizeof(plm_t) );
+
+    assert( p && m > 0 && eps >= 0 );
+
+    p->m = m;
+    p->eps = eps;
+    p->keys = (int *)malloc( m * sizeof(int) );
+    p->vals = (void **)malloc( m * sizeof(void *) );
+    p->segs = (plm_seg_t *)malloc( m * sizeof(plm_seg_t) );
+    assert( p->keys && p->vals && p->segs );
+
+    for( i=0; i<m; i++ ){
+        p->keys[i] = keys[i];
+        p->vals[i] = vals[i];
+    }
+
+    p->nsegs = _fit( p, eps );
+    p->segs = (plm_seg_t *)realloc( p->segs, p->nsegs * sizeof(plm_seg_t) );
+
+    //measure the error on the separators the model was trained on
+    p->max_err = 0;
+    for( i=0, j=0; i<m; i++ ){
+        if( i == 0 || keys[i] != keys[i-1] )
+            j = i;
+        err = abs( plmPredict( p, keys[i] ) - j );
+        if( err > p->max_err )
+            p->max_err = err;
+        sum += err;
+    }
+    p->avg_err = sum / m;
+
+    return p;
+}
+
+void
+plmFree( plm_t *p )
+{
+    if( p ){
+        free( p->keys );
+        free( p->vals );
+        free( p->segs );
+        free( p );
+    }
+}
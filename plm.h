@@ -0,0 +1,127 @@
+/*  plm.h
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+
+#ifndef _HEADER_PLM_
+#define _HEADER_PLM_
+
+/*
+ * Learned routing over the leaves of a tree: a piecewise linear model
+ * from a key to the position of the first leaf whose separator is
+ * >= key. keys[i] is the separator of vals[i], keys[m-1] that of the
+ * last leaf. Each segment is fitted so that no separator it covers is
+ * predicted more than eps positions off, so a lookup only searches a
+ * window of about 2*eps separators around the prediction. A result
+ * that cannot be confirmed inside the window is reported as a miss.
+ */
+typedef struct plm_seg {
+    int key;
+    int pos;
+    double slope;
+}plm_seg_t;
+
+typedef struct plm {
+    int m;
+    int eps;
+    int nsegs;
+    plm_seg_t *segs;
+    int *keys;
+    void **vals;
+    int max_err;
+    double avg_err;
+}plm_t;
+
+plm_t * plmBuild( const int *, void **, int, int );
+void plmFree( plm_t * );
+
+/* position predicted for key by the segment covering it */
+static inline int
+plmPredict( const plm_t *p, int key )
+{
+    int lo = 0, hi = p->nsegs-1, mid, end;
+    double y;
+    const plm_seg_t *s;
+
+    //last segment starting at or before key
+    while( lo < hi ){
+        mid = ( lo + hi + 1 ) / 2;
+        if( p->segs[mid].key <= key )
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    s = &p->segs[lo];
+    end = lo+1 < p->nsegs ? s[1].pos : p->m-1;
+
+    //keys in the gap before the next segment belong to its first leaf
+    y = s->pos + s->slope * ( (double)key - s->key );
+    if( y < s->pos )
+        return s->pos;
+    if( y > end )
+        return end;
+    return (int)( y + 0.5 );
+}
+
+/*
+ * Set *val to the leaf for key and return 1, or return 0 if the
+ * prediction missed and the caller must search some other way.
+ */
+static inline int
+plmFind( const plm_t *p, int key, void **val )
+{
+    int pos = plmPredict( p, key );
+    int lo = pos - p->eps - 1, hi = pos + p->eps + 1, i, len, half;
+    const int *k;
+
+    if( lo < 0 )
+        lo = 0;
+    if( hi > p->m-1 )
+        hi = p->m-1;
+
+    //branch-free lower bound over the window
+    k = p->keys + lo;
+    for( len = hi - lo + 1; len > 1; len -= half ){
+        half = len / 2;
+        k += ( k[half] < key ) * half;
+    }
+    i = k - p->keys + ( *k < key );
+
+    if( ( i == lo && lo > 0 && p->keys[lo-1] >= key ) || ( i > hi && hi < p->m-1 ) )
+        return 0;
+
+    *val = p->vals[i > p->m-1 ? p->m-1 : i];
+    return 1;
+}
+#endif
@@ -0,0 +1,159 @@
+/*  slab.c
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "slab.h"
+
+#define SLAB_ALIGN (64)
+
+void
+slabInit( slab_t *pool, size_t size, int per_slab )
+{
+    assert( per_slab > 0 );
+
+    if( size < sizeof(void *) )
+        size = sizeof(void *);
+
+    pool->size = ( size + SLAB_ALIGN - 1 ) & ~( SLAB_ALIGN - 1 );
+    pool->per_slab = per_slab;
+    pool->free = NULL;
+    pool->slabs = NULL;
+}
+
+void
+slabDestroy( slab_t *pool )
+{
+    void *slab, *next;
+
+    for( slab = pool->slabs; slab; slab = next ){
+        next = *(void **)slab;
+        free( slab );
+    }
+
+    pool->slabs = NULL;
+    pool->free = NULL;
+}
+
+/*
+ * A slab starts with the link to the previous slab, followed by
+ * per_slab blocks which are all threaded onto the free list. Slabs and
+ * block sizes are multiples of a cache line, so every block starts on
+ * a cache line boundary.
+ */
+static int
+_slab_grow( slab_t *pool )
+{
+    int i;
+    char *slab, *block;
+
+    if( posix_memalign( (void **)&slab, SLAB_ALIGN, SLAB_ALIGN + pool->size * pool->per_slab ) )
+        return -1;
+
+    *(void **)slab = pool->slabs;
+    pool->slabs = slab;
+
+    block = slab + SLAB_ALIGN;
+    for( i=0; i<pool->per_slab; i++, block += pool->size ){
+        *(void **)block = pool->free;
+        pool->free = block;
+    }
+
+    return 0;
+}
+
+void *
+slabAlloc( slab_t *pool )
+{
+    void *block;
+
+    if( !pool->free && _slab_grow( pool ) )
+        return NULL;
+
+    block = pool->free;
+    pool->free = *(void **)block;
+
+    return block;
+}
+
+void
+slabFree( slab_t *pool, void *block )
+{
+    *(void **)block = pool->free;
+    pool->free = block;
+}
+
+/*
+ * Move the slabs and free blocks of from, a pool of the same block
+ * size, into pool. Blocks handed out by from now belong to pool and
+ * from is left empty.
+ */
+void
+slabAdopt( slab_t *pool, slab_t *from )
+{
+    void **link;
+
+    assert( pool->size == from->size && pool->per_slab == from->per_slab );
+
+    if( from->slabs ){
+        for( link = &from->slabs; *link; link = (void **)*link )
+            ;
+        *link = pool->slabs;
+        pool->slabs = from->slabs;
+    }
+
+    if( from->free ){
+        for( link = &from->free; *link; link = (void **)*link )
+            ;
+        *link = pool->free;
+        pool->free = from->free;
+    }
+
+    from->slabs = NULL;
+    from->free = NULL;
+}
+
+/* memory held by the pool's slabs, whether their blocks are used or not */
+size_t
+slabBytes( slab_t *pool )
+{
+    void *slab;
+    size_t bytes = 0;
+
+    for( slab = pool->slabs; slab; slab = *(void **)slab )
+        bytes += SLAB_ALIGN + pool->size * pool->per_slab;
+
+    return bytes;
+}
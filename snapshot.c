@@ -0,0 +1,501 @@
+/*  snapshot.c
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bplustree.h"
+#include "snapshot.h"
+
+#define SNAP_MAGIC "BPTSNAP3"
+#define SNAP_ALIGN(x) ( ((x) + 63) & ~(size_t)63 )
+#define SNAP_CHUNK (256)
+
+/*
+ * Builds an image from the pairs of a tree in key order. Leaves are
+ * filled one pair at a time until the next pair would take the record
+ * past budget; offs and seps collect the offset and largest key of
+ * each node of the level being built. The image goes to fd, or to mem
+ * if fd is -1.
+ */
+typedef struct snap_writer {
+    int fd;
+    int err;
+    int pack;
+    int b_inner;
+    size_t budget;
+    long long nkeys;
+    long long off;
+    char *mem;
+    size_t cap;
+    char *buf;
+    int n;
+    int *keys;
+    int *data;
+    unsigned int dmin;
+    unsigned int dmax;
+    long long *offs;
+    int *seps;
+    long nnodes;
+    long max_nodes;
+}snap_writer_t;
+
+/* bytes per value for values spanning span */
+static int
+_span_width( unsigned int span )
+{
+    if( span <= 0xff )
+        return 1;
+    if( span <= 0xffff )
+        return 2;
+
+    return sizeof(int);
+}
+
+static size_t
+_leaf_record( int n, int width, int dwidth )
+{
+    return SNAP_ALIGN( sizeof(snap_node_t) + ( ( n * width + 7 ) & ~(size_t)7 ) + n * dwidth );
+}
+
+static size_t
+_non_leaf_record( int n )
+{
+    return SNAP_ALIGN( sizeof(snap_node_t) + ( ( n * sizeof(int) + 7 ) & ~(size_t)7 )
+                       + ( n+1 ) * sizeof(long long) );
+}
+
+static void
+_write_at( snap_writer_t *w, const void *buf, size_t size, long long off )
+{
+    if( w->fd >= 0 ){
+        if( pwrite( w->fd, buf, size, off ) != (ssize_t)size )
+            w->err = 1;
+        return;
+    }
+
+    if( off + size > w->cap ){
+        while( off + size > w->cap )
+            w->cap = w->cap ? 2*w->cap : 64*1024;
+        w->mem = (char *)realloc( w->mem, w->cap );
+        assert( w->mem );
+    }
+    memcpy( w->mem + off, buf, size );
+}
+
+static void
+_add_node( snap_writer_t *w, long long off, int sep )
+{
+    if( w->nnodes == w->max_nodes ){
+        w->max_nodes = w->max_nodes ? 2*w->max_nodes : 1024;
+        w->offs = (long long *)realloc( w->offs, w->max_nodes * sizeof(long long) );
+        w->seps = (int *)realloc( w->seps, w->max_nodes * sizeof(int) );
+        assert( w->offs && w->seps );
+    }
+
+    w->offs[w->nnodes] = off;
+    w->seps[w->nnodes] = sep;
+    w->nnodes++;
+}
+
+/* write the pending pairs as one leaf; last if no leaf follows it */
+static void
+_flush_leaf( snap_writer_t *w, int last )
+{
+    int i, n = w->n;
+    snap_node_t *s = (snap_node_t *)w->buf;
+    size_t size;
+    void *d;
+
+    memset( s, 0, sizeof(snap_node_t) );
+    s->type = BPLUS_TREE_LEAF;
+    s->n = n;
+    s->width = s->dwidth = sizeof(int);
+    if( w->pack ){
+        s->width = _span_width( (unsigned int)w->keys[n-1] - (unsigned int)w->keys[0] );
+        s->dwidth = _span_width( w->dmax - w->dmin );
+    }
+    if( s->width < (int)sizeof(int) )
+        s->base = w->keys[0];
+    if( s->dwidth < (int)sizeof(int) )
+        s->dbase = (int)w->dmin;
+
+    size = _leaf_record( n, s->width, s->dwidth );
+    memset( s + 1, 0, size - sizeof(snap_node_t) );
+    d = snapValues( s );
+
+    for( i=0; i<n; i++ ){
+        if( s->width == 1 )
+            ((unsigned char *)snapKeys( s ))[i] = (unsigned int)w->keys[i] - (unsigned int)s->base;
+        else if( s->width == 2 )
+            ((unsigned short *)snapKeys( s ))[i] = (unsigned int)w->keys[i] - (unsigned int)s->base;
+        else
+            snapKeys( s )[i] = w->keys[i];
+
+        if( s->dwidth == 1 )
+            ((unsigned char *)d)[i] = (unsigned int)w->data[i] - (unsigned int)s->dbase;
+        else if( s->dwidth == 2 )
+            ((unsigned short *)d)[i] = (unsigned int)w->data[i] - (unsigned int)s->dbase;
+        else
+            ((int *)d)[i] = w->data[i];
+    }
+
+    s->next = last ? 0 : (long long)size;
+
+    _write_at( w, s, size, w->off );
+    _add_node( w, w->off, w->keys[n-1] );
+    w->off += size;
+    w->nkeys += n;
+    w->n = 0;
+}
+
+static void
+_add_pair( snap_writer_t *w, int key, int data )
+{
+    unsigned int dmin, dmax;
+    int width = sizeof(int), dwidth = sizeof(int);
+
+    if( w->n ){
+        dmin = (unsigned int)data < w->dmin ? (unsigned int)data : w->dmin;
+        dmax = (unsigned int)data > w->dmax ? (unsigned int)data : w->dmax;
+        if( w->pack ){
+            width = _span_width( (unsigned int)key - (unsigned int)w->keys[0] );
+            dwidth = _span_width( dmax - dmin );
+        }
+        if( _leaf_record( w->n+1, width, dwidth ) > w->budget )
+            _flush_leaf( w, 0 );
+    }
+
+    if( !w->n )
+        w->dmin = w->dmax = (unsigned int)data;
+    else{
+        w->dmin = dmin;
+        w->dmax = dmax;
+    }
+
+    w->keys[w->n] = key;
+    w->data[w->n] = data;
+    w->n++;
+}
+
+/*
+ * Replace the nodes collected in offs/seps by a level of non-leaves
+ * over them, each with up to 2*b_inner children and all about equally
+ * full. Parents are recorded in place over their children.
+ */
+static void
+_write_level( snap_writer_t *w )
+{
+    long i, j, k, cnt, total = w->nnodes;
+    long nparents = ( total + 2*w->b_inner-1 ) / ( 2*w->b_inner );
+    snap_node_t *s = (snap_node_t *)w->buf;
+    size_t size;
+
+    for( i=0, k=0; i<nparents; i++ ){
+        cnt = total/nparents + ( i < total%nparents );
+        size = _non_leaf_record( cnt-1 );
+
+        memset( s, 0, size );
+        s->type = BPLUS_TREE_NON_LEAF;
+        s->n = cnt-1;
+        s->width = sizeof(int);
+        s->dwidth = sizeof(long long);
+        for( j=0; j<cnt; j++ ){
+            if( j<cnt-1 )
+                snapKeys( s )[j] = w->seps[k+j];
+            ((long long *)snapValues( s ))[j] = w->offs[k+j];
+        }
+
+        _write_at( w, s, size, w->off );
+        w->offs[i] = w->off;
+        w->seps[i] = w->seps[k+cnt-1];
+        w->off += size;
+        k += cnt;
+    }
+
+    w->nnodes = nparents;
+}
+
+/*
+ * Write the image of tree, read through a cursor, to w. A leaf gets as
+ * many pairs as fit in the record of a full plain leaf.
+ */
+static void
+_write_tree( snap_writer_t *w, bpt_t *tree, int pack )
+{
+    int i, got;
+    int kbuf[SNAP_CHUNK], dbuf[SNAP_CHUNK];
+    snap_header_t h;
+    bpt_cursor_t cur;
+    size_t inner = _non_leaf_record( 2*tree->b_inner-1 );
+
+    w->err = 0;
+    w->pack = pack;
+    w->b_inner = tree->b_inner;
+    w->budget = _leaf_record( 2*tree->b_leaf-1, sizeof(int), sizeof(int) );
+    w->nkeys = 0;
+    w->off = SNAP_ALIGN( sizeof(snap_header_t) );
+    w->mem = NULL;
+    w->cap = 0;
+    w->buf = (char *)malloc( w->budget > inner ? w->budget : inner );
+    //each pair takes at least 2 bytes of a record
+    w->keys = (int *)malloc( w->budget/2 * sizeof(int) );
+    w->data = (int *)malloc( w->budget/2 * sizeof(int) );
+    w->n = 0;
+    w->offs = NULL;
+    w->seps = NULL;
+    w->nnodes = 0;
+    w->max_nodes = 0;
+    assert( w->buf && w->keys && w->data );
+
+    bptCursorSeek( tree, &cur, INT_MIN, INT_MAX );
+    while( ( got = bptCursorNext( &cur, kbuf, dbuf, SNAP_CHUNK ) ) > 0 )
+        for( i=0; i<got; i++ )
+            _add_pair( w, kbuf[i], dbuf[i] );
+    if( w->n )
+        _flush_leaf( w, 1 );
+
+    while( w->nnodes > 1 )
+        _write_level( w );
+
+    memset( &h, 0, sizeof(h) );
+    memcpy( h.magic, SNAP_MAGIC, sizeof(h.magic) );
+    h.b_leaf = tree->b_leaf;
+    h.b_inner = tree->b_inner;
+    h.nkeys = w->nkeys;
+    h.root = w->nnodes ? w->offs[0] : 0;
+    h.size = w->off;
+    _write_at( w, &h, sizeof(h), 0 );
+
+    free( w->buf );
+    free( w->keys );
+    free( w->data );
+    free( w->offs );
+    free( w->seps );
+}
+
+/*
+ * Write an image of tree to path, with delta-packed leaves if pack is
+ * set. The file is built next to path and renamed over it once
+ * complete, so readers never map a partial snapshot. Returns 0 on
+ * success.
+ */
+int
+snapWrite( bpt_t *tree, const char *path, int pack )
+{
+    snap_writer_t w;
+    size_t len = strlen( path );
+    char *tmp = (char *)malloc( len + 5 );
+
+    assert( tmp );
+    memcpy( tmp, path, len );
+    memcpy( tmp + len, ".tmp", 5 );
+
+    w.fd = open( tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if( w.fd < 0 ){
+        printf("Cannot create %s\n", tmp);
+        free( tmp );
+        return -1;
+    }
+
+    _write_tree( &w, tree, pack );
+
+    if( ftruncate( w.fd, w.off ) || fsync( w.fd ) )
+        w.err = 1;
+
+    close( w.fd );
+
+    if( w.err || rename( tmp, path ) ){
+        printf("Cannot write snapshot %s\n", path);
+        unlink( tmp );
+        free( tmp );
+        return -1;
+    }
+
+    free( tmp );
+    return 0;
+}
+
+/*
+ * Build an image of tree in memory, with delta-packed leaves if pack
+ * is set, and return it ready to search as if mapped by snapOpen.
+ */
+snapshot_t *
+snapBuild( bpt_t *tree, int pack )
+{
+    snap_writer_t w;
+    snapshot_t *s = (snapshot_t *)malloc( sizeof(snapshot_t) );
+    char *base;
+
+    assert( s );
+
+    w.fd = -1;
+    _write_tree( &w, tree, pack );
+
+    //move the image to a 64-byte boundary, as the records are aligned
+    w.mem = (char *)realloc( w.mem, w.off + 63 );
+    assert( w.mem );
+    base = (char *)( ( (size_t)w.mem + 63 ) & ~(size_t)63 );
+    memmove( base, w.mem, w.off );
+
+    s->base = base;
+    s->size = w.off;
+    s->mem = w.mem;
+    s->search = keySearchSelect();
+    s->rank = keyDeltaRankSelect();
+
+    return s;
+}
+
+/* map a snapshot read-only; returns NULL if path is not one */
+snapshot_t *
+snapOpen( const char *path )
+{
+    int fd;
+    struct stat st;
+    void *base;
+    const snap_header_t *h;
+    snapshot_t *s;
+
+    fd = open( path, O_RDONLY );
+    if( fd < 0 ){
+        printf("Cannot open %s\n", path);
+        return NULL;
+    }
+
+    if( fstat( fd, &st ) || st.st_size < (off_t)sizeof(snap_header_t) ){
+        printf("%s is not a snapshot\n", path);
+        close( fd );
+        return NULL;
+    }
+
+    base = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( base == MAP_FAILED ){
+        printf("Cannot map %s\n", path);
+        return NULL;
+    }
+
+    h = (const snap_header_t *)base;
+    if( memcmp( h->magic, SNAP_MAGIC, sizeof(h->magic) ) || h->size != st.st_size
+        || h->b_leaf < 3 || h->b_inner < 3 || h->root < 0 || h->root >= h->size ){
+        printf("%s is not a snapshot\n", path);
+        munmap( base, st.st_size );
+        return NULL;
+    }
+
+    s = (snapshot_t *)malloc( sizeof(snapshot_t) );
+    assert( s );
+    s->base = (const char *)base;
+    s->size = st.st_size;
+    s->mem = NULL;
+    s->search = keySearchSelect();
+    s->rank = keyDeltaRankSelect();
+
+    return s;
+}
+
+void
+snapClose( snapshot_t *s )
+{
+    if( s ){
+        if( s->mem )
+            free( s->mem );
+        else
+            munmap( (void *)s->base, s->size );
+        free( s );
+    }
+}
+
+/*
+ * Leaf that would hold key, with *pos set to the slot of the first key
+ * not less than key. NULL if the snapshot is empty.
+ */
+const snap_node_t *
+snapSeek( snapshot_t *s, int key, int *pos )
+{
+    int i;
+    long long root = ((const snap_header_t *)s->base)->root;
+    const snap_node_t *node;
+
+    if( !root )
+        return NULL;
+
+    node = (const snap_node_t *)( s->base + root );
+
+    while( node->type == BPLUS_TREE_NON_LEAF ){
+        i = s->search( snapKeys( node ), node->n, key );
+        if( i < 0 )
+            i = -i - 1;
+        node = (const snap_node_t *)( s->base + ((long long *)snapValues( node ))[i] );
+    }
+
+    if( node->width == sizeof(int) ){
+        i = s->search( snapKeys( node ), node->n, key );
+        *pos = i < 0 ? -i - 1 : i;
+    }
+    else if( key < node->base )
+        *pos = 0;
+    else if( (unsigned int)key - (unsigned int)node->base >= 1u << ( 8*node->width ) )
+        *pos = node->n;
+    else
+        *pos = s->rank( snapKeys( node ), node->width, node->n,
+                        (unsigned int)key - (unsigned int)node->base );
+
+    return node;
+}
+
+/* same results as bptGet on the tree the snapshot was taken from */
+int
+snapGet( snapshot_t *s, int key )
+{
+    int i;
+    const snap_node_t *leaf = snapSeek( s, key, &i );
+
+    if( !leaf )
+        return 0;
+
+    if( i < leaf->n && snapKey( leaf, i ) == key )
+        return snapData( leaf, i );
+
+    return DATA_NOT_EXIST;
+}
@@ -0,0 +1,142 @@
+/*  snapshot.h
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+
+#ifndef _HEADER_SNAPSHOT_
+#define _HEADER_SNAPSHOT_
+
+#include <stddef.h>
+
+#include "keysearch.h"
+
+struct tree;
+
+/*
+ * Read-only image of a tree, written once and then mapped and searched
+ * in place. Every reference is a byte offset, so the file can be mapped
+ * at any address and shared by several processes. The same image can
+ * also be built in memory (snapBuild) to hold a packed tree.
+ *
+ * The header is followed by the leaves in key order, then the
+ * non-leaves level by level, the root last. Each node record starts on
+ * a 64-byte boundary and holds a snap_node_t, n keys and then n data or
+ * n+1 child offsets. A leaf's next is the distance in bytes to the
+ * following leaf, 0 for the last one.
+ *
+ * Leaves are filled to the size of a full leaf of the tree, b_leaf,
+ * rather than copied node by node. Keys take width bytes each and data
+ * dwidth bytes each. Non-leaves always store plain 4-byte keys. A
+ * packed image stores the keys of a leaf as 1- or 2-byte unsigned
+ * deltas from its first key, base, while they span less than 2^8 or
+ * 2^16, and its data likewise from their minimum, dbase, so a dense
+ * leaf holds two to four times the entries of a plain one.
+ */
+typedef struct snap_header {
+    char magic[8];
+    int b_leaf;
+    int b_inner;
+    long long nkeys;
+    long long root;
+    long long size;
+}snap_header_t;
+
+typedef struct snap_node {
+    int type;
+    int n;
+    long long next;
+    int base;
+    int width;
+    int dbase;
+    int dwidth;
+}snap_node_t;
+
+/* mem is the image's allocation if it was built in memory, else NULL */
+typedef struct snapshot {
+    const char *base;
+    size_t size;
+    void *mem;
+    key_search_fn search;
+    delta_rank_fn rank;
+}snapshot_t;
+
+/* plain keys; for a leaf with width < 4, its deltas */
+static inline int *
+snapKeys( const snap_node_t *node )
+{
+    return (int *)( node + 1 );
+}
+
+static inline int
+snapKey( const snap_node_t *node, int i )
+{
+    if( node->width == 1 )
+        return (int)( (unsigned int)node->base + ((const unsigned char *)( node + 1 ))[i] );
+    if( node->width == 2 )
+        return (int)( (unsigned int)node->base + ((const unsigned short *)( node + 1 ))[i] );
+    return snapKeys( node )[i];
+}
+
+/* data of a leaf, or child offsets of a non-leaf, after the keys */
+static inline void *
+snapValues( const snap_node_t *node )
+{
+    return (char *)snapKeys( node ) + ( ( node->n * node->width + 7 ) & ~(size_t)7 );
+}
+
+static inline const snap_node_t *
+snapNext( const snap_node_t *leaf )
+{
+    return leaf->next ? (const snap_node_t *)( (const char *)leaf + leaf->next ) : NULL;
+}
+
+static inline int
+snapData( const snap_node_t *leaf, int i )
+{
+    const void *d = snapValues( leaf );
+
+    if( leaf->dwidth == 1 )
+        return (int)( (unsigned int)leaf->dbase + ((const unsigned char *)d)[i] );
+    if( leaf->dwidth == 2 )
+        return (int)( (unsigned int)leaf->dbase + ((const unsigned short *)d)[i] );
+    return ((const int *)d)[i];
+}
+
+int snapWrite( struct tree *, const char *, int );
+snapshot_t * snapBuild( struct tree *, int );
+snapshot_t * snapOpen( const char * );
+void snapClose( snapshot_t * );
+int snapGet( snapshot_t *, int );
+const snap_node_t * snapSeek( snapshot_t *, int, int * );
+#endif
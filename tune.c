@@ -0,0 +1,140 @@
+/*  tune.c
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bplustree.h"
+
+#define TUNE_SCAN_LEN (128)
+#define NSIZES(a) (int)( sizeof(a) / sizeof((a)[0]) )
+
+static const int inner_sizes[] = { 256, 512, 1024, 2048 };
+static const int leaf_sizes[] = { 256, 1024, 4096, 16384 };
+
+static double
+_now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int
+_tune_sink( int key, int data, void *arg )
+{
+    *(int *)arg += data;
+    return 0;
+}
+
+/*
+ * Time nkeys random point lookups plus range scans that read the same
+ * number of pairs on a tree bulk loaded with nkeys keys.
+ */
+static double
+_tune_run( int inner_bytes, int leaf_bytes, int *keys, int *probes, int nkeys )
+{
+    int i, sink = 0;
+    double start;
+    bpt_t *t;
+
+    t = bptInitSized( inner_bytes, leaf_bytes );
+    if( !t )
+        return -1;
+
+    bptBulkLoad( t, keys, keys, nkeys, 1.0 );
+
+    start = _now();
+
+    for( i=0; i<nkeys; i++ )
+        sink += bptGet( t, probes[i] );
+
+    for( i=0; i<nkeys; i+=TUNE_SCAN_LEN )
+        bptScan( t, probes[i], probes[i]+TUNE_SCAN_LEN-1, _tune_sink, &sink );
+
+    start = _now() - start;
+
+    bptDestroy( t );
+
+    return start;
+}
+
+/*
+ * Benchmark the candidate node sizes on this host with nkeys keys and
+ * report the fastest inner/leaf byte sizes for bptInitSized.
+ */
+void
+bptTune( int nkeys, int *inner_bytes, int *leaf_bytes )
+{
+    int i, j;
+    int *keys, *probes;
+    double elapsed, best = -1;
+
+    *inner_bytes = inner_sizes[0];
+    *leaf_bytes = leaf_sizes[2];
+
+    if( nkeys <= 0 )
+        return;
+
+    keys = (int *) malloc( nkeys * sizeof(int) );
+    probes = (int *) malloc( nkeys * sizeof(int) );
+
+    if( !keys || !probes )
+        goto out;
+
+    for( i=0; i<nkeys; i++ ){
+        keys[i] = 2*i;
+        probes[i] = 2 * ( rand() % nkeys );
+    }
+
+    for( i=0; i<NSIZES(inner_sizes); i++ )
+        for( j=0; j<NSIZES(leaf_sizes); j++ ){
+            elapsed = _tune_run( inner_sizes[i], leaf_sizes[j], keys, probes, nkeys );
+            if( elapsed < 0 )
+                continue;
+
+            if( best < 0 || elapsed < best ){
+                best = elapsed;
+                *inner_bytes = inner_sizes[i];
+                *leaf_bytes = leaf_sizes[j];
+            }
+        }
+
+out:
+    free( keys );
+    free( probes );
+}
@@ -0,0 +1,467 @@
+/*  wal.c
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "wal.h"
+#include "bplustree.h"
+
+#define WAL_BUF_INIT (64 * sizeof(wal_rec_t))
+#define WAL_READ_RECS (256)
+/* pairs copied per cursor step when writing a checkpoint */
+#define CKPT_CHUNK (256)
+/* leaf fill of a tree rebuilt from a checkpoint, leaving room for writes */
+#define CKPT_FILL (0.7)
+
+static const char ckpt_magic[8] = "BPTCKPT";
+
+/* FNV-1a over everything but the checksum itself */
+static unsigned int
+_rec_sum( const wal_rec_t *r )
+{
+    const unsigned char *p = (const unsigned char *)r;
+    unsigned int h = 2166136261u;
+    size_t i;
+
+    for( i=0; i<offsetof(wal_rec_t, sum); i++ )
+        h = ( h ^ p[i] ) * 16777619u;
+
+    return h;
+}
+
+static int
+_write_all( int fd, const char *buf, size_t len )
+{
+    ssize_t w;
+
+    while( len > 0 ){
+        w = write( fd, buf, len );
+        if( w < 0 )
+            return -1;
+        buf += w;
+        len -= w;
+    }
+
+    return 0;
+}
+
+/*
+ * Feed the valid prefix of the log to replay, skipping records up to
+ * from_lsn that an earlier checkpoint already holds, and cut off
+ * whatever follows it. Returns the last sequence number seen.
+ */
+static unsigned long long
+_replay( wal_t *w, unsigned long long from_lsn, wal_replay_fn replay, void *ctx )
+{
+    wal_rec_t recs[WAL_READ_RECS];
+    unsigned long long last = 0;
+    off_t valid = 0;
+    ssize_t got;
+    int i, m, done = 0;
+
+    while( !done && ( got = pread( w->fd, recs, sizeof(recs), valid ) ) > 0 ){
+        m = got / sizeof(wal_rec_t);
+        done = m < WAL_READ_RECS;
+        for( i=0; i<m; i++ ){
+            if( recs[i].sum != _rec_sum( &recs[i] ) || recs[i].lsn <= last ){
+                done = 1;
+                break;
+            }
+            last = recs[i].lsn;
+            if( last > from_lsn && replay )
+                replay( ctx, recs[i].op, recs[i].key, recs[i].data );
+            valid += sizeof(wal_rec_t);
+        }
+    }
+
+    if( ftruncate( w->fd, valid ) < 0 )
+        printf("WAL: cannot drop torn tail\n");
+    w->size = valid;
+
+    return last;
+}
+
+/*
+ * Open or create the log at path and replay the records after from_lsn
+ * through replay. Appending resumes after the last valid record.
+ * Returns NULL if the file cannot be opened.
+ */
+wal_t *
+walOpen( const char *path, unsigned long long from_lsn, wal_replay_fn replay, void *ctx )
+{
+    wal_t *w;
+    unsigned long long last;
+
+    w = (wal_t *)malloc( sizeof(wal_t) );
+    if( !w )
+        return NULL;
+
+    w->fd = open( path, O_RDWR | O_CREAT | O_APPEND, 0644 );
+    if( w->fd < 0 ){
+        free( w );
+        return NULL;
+    }
+
+    pthread_mutex_init( &w->lock, NULL );
+    pthread_cond_init( &w->synced, NULL );
+    pthread_rwlock_init( &w->ckpt_lock, NULL );
+    w->cap = WAL_BUF_INIT;
+    w->buf = (char *)malloc( w->cap );
+    w->sbuf = (char *)malloc( w->cap );
+    assert( w->buf && w->sbuf );
+    w->len = 0;
+    w->flushing = 0;
+    w->error = 0;
+    w->syncs = 0;
+
+    last = _replay( w, from_lsn, replay, ctx );
+    w->flushed = w->size;
+    w->next_lsn = ( last > from_lsn ? last : from_lsn ) + 1;
+    w->durable = w->next_lsn - 1;
+
+    return w;
+}
+
+/*
+ * Make every appended record durable and release the log. Returns -1
+ * if some record could not be made durable.
+ */
+int
+walClose( wal_t *w )
+{
+    int r;
+
+    if( !w )
+        return 0;
+
+    pthread_rwlock_rdlock( &w->ckpt_lock );
+    r = walCommit( w, w->next_lsn - 1 );
+
+    close( w->fd );
+    free( w->buf );
+    free( w->sbuf );
+    pthread_rwlock_destroy( &w->ckpt_lock );
+    pthread_cond_destroy( &w->synced );
+    pthread_mutex_destroy( &w->lock );
+    free( w );
+
+    return r;
+}
+
+/* buffer one record with w->lock held */
+static unsigned long long
+_append( wal_t *w, int op, int key, int data )
+{
+    wal_rec_t r;
+
+    if( w->len + sizeof(r) > w->cap ){
+        w->cap *= 2;
+        w->buf = (char *)realloc( w->buf, w->cap );
+        assert( w->buf );
+    }
+
+    memset( &r, 0, sizeof(r) );
+    r.lsn = w->next_lsn++;
+    r.op = op;
+    r.key = key;
+    r.data = data;
+    r.sum = _rec_sum( &r );
+    memcpy( w->buf + w->len, &r, sizeof(r) );
+    w->len += sizeof(r);
+    __atomic_store_n( &w->size, w->size + sizeof(r), __ATOMIC_RELAXED );
+
+    return r.lsn;
+}
+
+/*
+ * Buffer a record and return its sequence number. The caller applies
+ * the operation and then calls walCommit, which must follow.
+ */
+unsigned long long
+walAppend( wal_t *w, int op, int key, int data )
+{
+    unsigned long long lsn;
+
+    pthread_rwlock_rdlock( &w->ckpt_lock );
+    pthread_mutex_lock( &w->lock );
+    lsn = _append( w, op, key, data );
+    pthread_mutex_unlock( &w->lock );
+
+    return lsn;
+}
+
+/*
+ * Buffer n records with the same op at once and return the sequence
+ * number of the last; one walCommit covers them all. n must be > 0.
+ */
+unsigned long long
+walAppendBatch( wal_t *w, int op, const int *keys, const int *data, int n )
+{
+    int i;
+    unsigned long long lsn = 0;
+
+    assert( n > 0 );
+
+    pthread_rwlock_rdlock( &w->ckpt_lock );
+    pthread_mutex_lock( &w->lock );
+    for( i=0; i<n; i++ )
+        lsn = _append( w, op, keys[i], data[i] );
+    pthread_mutex_unlock( &w->lock );
+
+    return lsn;
+}
+
+/*
+ * Wait until the record lsn is on disk. Whoever finds no sync running
+ * takes the whole buffer, swaps in the spare one so that others keep
+ * appending, and writes and syncs it without holding the lock.
+ * Returns 0 once the record is durable and -1 if the log failed
+ * before it got there.
+ */
+int
+walCommit( wal_t *w, unsigned long long lsn )
+{
+    char *batch;
+    size_t len;
+    unsigned long long upto;
+    int err, r;
+
+    pthread_rwlock_unlock( &w->ckpt_lock );
+    pthread_mutex_lock( &w->lock );
+
+    while( w->durable < lsn && !w->error ){
+        if( w->flushing ){
+            pthread_cond_wait( &w->synced, &w->lock );
+            continue;
+        }
+
+        w->flushing = 1;
+        batch = w->buf;
+        len = w->len;
+        upto = w->next_lsn - 1;
+        /* the spare falls behind when appends grew the buffer */
+        w->buf = (char *)realloc( w->sbuf, w->cap );
+        assert( w->buf );
+        w->len = 0;
+        pthread_mutex_unlock( &w->lock );
+
+        err = _write_all( w->fd, batch, len ) < 0 || fdatasync( w->fd ) < 0;
+        if( err ){
+            printf("WAL: write failed, no more records are logged\n");
+            if( ftruncate( w->fd, w->flushed ) < 0 )
+                printf("WAL: cannot drop torn batch\n");
+        }
+
+        pthread_mutex_lock( &w->lock );
+        w->sbuf = batch;
+        if( err )
+            w->error = -1;
+        else{
+            w->flushed += len;
+            if( upto > w->durable )
+                w->durable = upto;
+        }
+        w->flushing = 0;
+        w->syncs++;
+        pthread_cond_broadcast( &w->synced );
+    }
+
+    r = w->durable >= lsn ? 0 : -1;
+    //records appended after a failure are never written
+    if( w->error )
+        w->len = 0;
+
+    pthread_mutex_unlock( &w->lock );
+
+    return r;
+}
+
+/*
+ * Stop all writers for a checkpoint and return the sequence number of
+ * the last record, which the checkpoint must cover. Every operation
+ * logged so far has been applied.
+ */
+unsigned long long
+walCheckpointBegin( wal_t *w )
+{
+    unsigned long long lsn;
+
+    pthread_rwlock_wrlock( &w->ckpt_lock );
+    pthread_mutex_lock( &w->lock );
+    while( w->flushing )
+        pthread_cond_wait( &w->synced, &w->lock );
+    lsn = w->next_lsn - 1;
+    pthread_mutex_unlock( &w->lock );
+
+    return lsn;
+}
+
+/*
+ * Let writers resume. Once the checkpoint is durable the records it
+ * covers are dropped; if it failed the log is kept as it is. The new,
+ * empty log clears an earlier write error.
+ */
+void
+walCheckpointEnd( wal_t *w, int ok )
+{
+    pthread_mutex_lock( &w->lock );
+    if( ok ){
+        w->len = 0;
+        __atomic_store_n( &w->size, 0, __ATOMIC_RELAXED );
+        w->durable = w->next_lsn - 1;
+        w->flushed = 0;
+        w->error = 0;
+        if( ftruncate( w->fd, 0 ) < 0 || fdatasync( w->fd ) < 0 ){
+            printf("WAL: cannot truncate log\n");
+            w->error = -1;
+        }
+        pthread_cond_broadcast( &w->synced );
+    }
+    pthread_mutex_unlock( &w->lock );
+    pthread_rwlock_unlock( &w->ckpt_lock );
+}
+
+/*
+ * Write the tree as the checkpoint after record lsn. The file is built
+ * next to path and renamed over it once synced, so a crash leaves
+ * either the old checkpoint or the new one. Returns 0 on success.
+ */
+int
+walCheckpointWrite( const char *path, unsigned long long lsn, bpt_t *tree )
+{
+    ckpt_header_t h;
+    bpt_cursor_t cur;
+    int keys[CKPT_CHUNK], data[CKPT_CHUNK], pairs[2*CKPT_CHUNK];
+    int i, got, fd, err = 0;
+    size_t len = strlen( path );
+    char *tmp = (char *)malloc( len + 5 );
+
+    assert( tmp );
+    memcpy( tmp, path, len );
+    memcpy( tmp + len, ".tmp", 5 );
+
+    fd = open( tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if( fd < 0 ){
+        printf("Cannot create %s\n", tmp);
+        free( tmp );
+        return -1;
+    }
+
+    memcpy( h.magic, ckpt_magic, sizeof(h.magic) );
+    h.lsn = lsn;
+    h.n = 0;
+    err = _write_all( fd, (const char *)&h, sizeof(h) );
+
+    bptCursorSeek( tree, &cur, INT_MIN, INT_MAX );
+    while( !err && ( got = bptCursorNext( &cur, keys, data, CKPT_CHUNK ) ) > 0 ){
+        for( i=0; i<got; i++ ){
+            pairs[2*i] = keys[i];
+            pairs[2*i+1] = data[i];
+        }
+        err = _write_all( fd, (const char *)pairs, got * 2 * sizeof(int) );
+        h.n += got;
+    }
+
+    if( !err )
+        err = pwrite( fd, &h, sizeof(h), 0 ) != sizeof(h) || fsync( fd );
+    close( fd );
+
+    if( err || rename( tmp, path ) ){
+        printf("Cannot write checkpoint %s\n", path);
+        unlink( tmp );
+        free( tmp );
+        return -1;
+    }
+
+    free( tmp );
+    return 0;
+}
+
+/*
+ * Bulk load the checkpoint at path into the empty tree and store the
+ * sequence number it covers in lsn. A missing checkpoint leaves the
+ * tree empty with lsn 0. Returns -1 if the file is not a checkpoint.
+ */
+int
+walCheckpointLoad( const char *path, bpt_t *tree, unsigned long long *lsn )
+{
+    ckpt_header_t h;
+    int *pairs, *keys, *data;
+    long long i;
+    int fd, ret = -1;
+
+    *lsn = 0;
+
+    fd = open( path, O_RDONLY );
+    if( fd < 0 )
+        return 0;
+
+    if( read( fd, &h, sizeof(h) ) != sizeof(h) ||
+        memcmp( h.magic, ckpt_magic, sizeof(h.magic) ) || h.n < 0 || h.n > INT_MAX ){
+        printf("%s is not a checkpoint\n", path);
+        close( fd );
+        return -1;
+    }
+
+    pairs = (int *)malloc( ( h.n + 1 ) * 2 * sizeof(int) );
+    keys = (int *)malloc( ( h.n + 1 ) * sizeof(int) );
+    data = (int *)malloc( ( h.n + 1 ) * sizeof(int) );
+    assert( pairs && keys && data );
+
+    if( pread( fd, pairs, h.n * 2 * sizeof(int), sizeof(h) ) == (ssize_t)( h.n * 2 * sizeof(int) ) ){
+        for( i=0; i<h.n; i++ ){
+            keys[i] = pairs[2*i];
+            data[i] = pairs[2*i+1];
+        }
+        ret = bptBulkLoad( tree, keys, data, h.n, CKPT_FILL );
+        *lsn = h.lsn;
+    }
+    else
+        printf("Checkpoint %s is truncated\n", path);
+
+    free( pairs );
+    free( keys );
+    free( data );
+    close( fd );
+
+    return ret;
+}
@@ -0,0 +1,122 @@
+/*  wal.h
+ *  Author: Yue Yang ( yueyang2010@gmail.com )
+ *
+ *
+* Copyright (c) 2015, Yue Yang ( yueyang2010@gmail.com )
+*  * All rights reserved.
+*  *
+*  - Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*  Redistributions of source code must retain the above copyright notice,
+*  this list of conditions and the following disclaimer.
+*
+*  - Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*
+*  - Neither the name of Redis nor the names of its contributors may be used
+*  to endorse or promote products derived from this software without
+*  specific prior written permission.
+*  
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+*  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+*  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+*  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+*  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+*  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+*  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+*  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+*  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*                          
+*/
+
+
+
+#ifndef _HEADER_WAL_
+#define _HEADER_WAL_
+
+#include <stddef.h>
+#include <pthread.h>
+
+struct tree;
+
+enum {
+    WAL_PUT = 1,
+    WAL_REMOVE = 2,
+    WAL_UPSERT = 3,
+    WAL_INSERT_IF_ABSENT = 4,
+    WAL_REPLACE = 5,
+    WAL_REMOVE_RANGE = 6,
+};
+
+/*
+ * Log records have a fixed size. Every record carries its own sequence
+ * number and a checksum, so a record torn by a crash ends the log.
+ */
+typedef struct wal_rec {
+    unsigned long long lsn;
+    int op;
+    int key;
+    int data;
+    unsigned int sum;
+}wal_rec_t;
+
+/*
+ * A checkpoint file holds a ckpt_header_t and then n key/data pairs in
+ * key order, the content of the tree after record lsn.
+ */
+typedef struct ckpt_header {
+    char magic[8];
+    unsigned long long lsn;
+    long long n;
+}ckpt_header_t;
+
+/* called for each record found in the log when it is opened */
+typedef void (*wal_replay_fn)( void *ctx, int op, int key, int data );
+
+/*
+ * Write-ahead log with group commit. Writers append records to an
+ * in-memory buffer; the first committer to find no flush in progress
+ * becomes the leader and writes and syncs everything appended so far,
+ * while the others wait and are released by that one sync. Records
+ * that arrive during a sync go out together with the next one.
+ *
+ * ckpt_lock is held shared from walAppend to walCommit, so a
+ * checkpoint taking it exclusively sees every logged record applied.
+ *
+ * flushed is the length of the file up to the last synced batch. A
+ * batch that fails to be written or synced is cut off there again, so
+ * no torn record hides later ones from replay, and error is latched:
+ * nothing more is written and walCommit fails until a checkpoint
+ * starts a new log.
+ */
+typedef struct wal {
+    int fd;
+    pthread_mutex_t lock;
+    pthread_cond_t synced;
+    pthread_rwlock_t ckpt_lock;
+    char *buf;
+    char *sbuf;
+    size_t len;
+    size_t cap;
+    int flushing;
+    unsigned long long next_lsn;
+    unsigned long long durable;
+    long long size;
+    long long flushed;
+    int error;
+    unsigned long syncs;
+}wal_t;
+
+wal_t * walOpen( const char *, unsigned long long, wal_replay_fn, void * );
+int walClose( wal_t * );
+unsigned long long walAppend( wal_t *, int, int, int );
+unsigned long long walAppendBatch( wal_t *, int, const int *, const int *, int );
+int walCommit( wal_t *, unsigned long long );
+unsigned long long walCheckpointBegin( wal_t * );
+void walCheckpointEnd( wal_t *, int );
+int walCheckpointWrite( const char *, unsigned long long, struct tree * );
+int walCheckpointLoad( const char *, struct tree *, unsigned long long * );
+#endif